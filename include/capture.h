@@ -0,0 +1,27 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+namespace r3 {
+namespace capture {
+
+    // A captured extension call, time is in microseconds since the start of the capture.
+    struct Entry {
+        uint64_t time;
+        std::string function;
+    };
+
+    bool initialize(const std::string& extensionFolder);
+    void finalize();
+    bool isEnabled();
+    void record(const char* function, size_t length);
+    bool load(const std::string& path, std::vector<Entry>& entries);
+
+} // namespace capture
+} // namespace r3
+
+#endif // CAPTURE_H
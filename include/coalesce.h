@@ -0,0 +1,38 @@
+#ifndef COALESCE_H
+#define COALESCE_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+namespace r3 {
+
+    class Request;
+
+namespace coalesce {
+
+    // Events of a configured type are held back per (replayId, playerId, type) for one window.
+    // Latest writes only the last event of the window, Merge writes one row at the mission time
+    // of the first event whose value is [[missionTime,value],...] of all events in the window. Values
+    // other than numbers and arrays are quoted as SQF strings.
+    enum class Mode {
+        None,
+        Latest,
+        Merge
+    };
+
+    void initialize(size_t workers, const std::chrono::milliseconds& window, const std::vector<std::string>& latestTypes, const std::vector<std::string>& mergeTypes);
+    void finalize();
+    bool isEnabled();
+    std::chrono::milliseconds getWindow();
+    // Takes coalesced events out of the batch and appends those whose window ended, or all of them if flushAll.
+    void process(size_t worker, std::vector<Request>& batch, bool flushAll);
+    size_t pending(size_t worker);
+    uint64_t getCoalesced();
+
+} // namespace coalesce
+} // namespace r3
+
+#endif // COALESCE_H
@@ -0,0 +1,171 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include "tokenizer.h"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+
+namespace r3 {
+
+    class Request;
+
+    enum class Command : uint8_t {
+        Unknown,
+        Poison,
+        Version,
+        Separator,
+        Stats,
+        Queue,
+        Connect,
+        Status,
+        Next,
+        Replay,
+        Result,
+        Player,
+        Event,
+        // Inserts a replay with an id handed out from a reserved block, params are those of 'replay' followed by the id.
+        InsertReplay,
+        // Refreshes lastSeen of known players whose repeated 'player' requests were coalesced, params are the player ids.
+        TouchPlayers,
+        Count
+    };
+
+namespace commands {
+
+    enum class Param : uint8_t {
+        String,
+        Unsigned,
+        Float
+    };
+
+    // Sync commands are answered by call(), Ticket commands by a writer through 'result', Queued
+    // commands are written by the writers without an answer and Internal ones are not accepted from SQF.
+    enum class Handling : uint8_t {
+        Sync,
+        Ticket,
+        Queued,
+        Internal
+    };
+
+    const uint8_t VARIADIC = 0xFF;
+    const size_t MAX_PARAMS = 5;
+
+    // Params are those after the command name. The writers build a multi-row statement from
+    // insertHead, insertRow repeated once per row and insertTail.
+    struct Definition {
+        const char* name;
+        Command command;
+        Handling handling;
+        uint8_t paramCount;
+        Param params[MAX_PARAMS];
+        const char* insertHead;
+        const char* insertRow;
+        const char* insertTail;
+    };
+
+    // Ordered like Command, so a definition is looked up by indexing with its command.
+    constexpr Definition DEFINITIONS[] = {
+        { "", Command::Unknown, Handling::Internal, 0, {}, "", "", "" },
+        { "poison", Command::Poison, Handling::Internal, 0, {}, "", "", "" },
+        { "version", Command::Version, Handling::Sync, 0, {}, "", "", "" },
+        { "separator", Command::Separator, Handling::Sync, 0, {}, "", "", "" },
+        { "stats", Command::Stats, Handling::Sync, 0, {}, "", "", "" },
+        { "queue", Command::Queue, Handling::Sync, 0, {}, "", "", "" },
+        { "connect", Command::Connect, Handling::Sync, 0, {}, "", "", "" },
+        { "status", Command::Status, Handling::Sync, 0, {}, "", "", "" },
+        { "next", Command::Next, Handling::Sync, 1, { Param::Unsigned }, "", "", "" },
+        { "replay", Command::Replay, Handling::Ticket, 4, { Param::String, Param::String, Param::Float, Param::String },
+            "INSERT INTO replays(missionName, map, dayTime, dateStarted, addonVersion) VALUES ", "(?, ?, ?, NOW(), ?)", "" },
+        { "result", Command::Result, Handling::Sync, 1, { Param::Unsigned }, "", "", "" },
+        { "player", Command::Player, Handling::Queued, 2, { Param::String, Param::String },
+            "INSERT INTO players(id, name, lastSeen) VALUES ", "(?, ?, NOW())", " ON DUPLICATE KEY UPDATE lastSeen = NOW()" },
+        { "event", Command::Event, Handling::Queued, 5, { Param::Unsigned, Param::String, Param::String, Param::String, Param::Float },
+            "INSERT INTO events(replayId, playerId, type, value, missionTime, added) VALUES ", "(?, ?, ?, ?, ?, NOW())", "" },
+        { "insertReplay", Command::InsertReplay, Handling::Internal, 5, { Param::String, Param::String, Param::Float, Param::String, Param::Unsigned },
+            "INSERT INTO replays(id, missionName, map, dayTime, dateStarted, addonVersion) VALUES ", "(?, ?, ?, ?, NOW(), ?)", "" },
+        { "touchPlayers", Command::TouchPlayers, Handling::Internal, VARIADIC, { Param::String },
+            "UPDATE players SET lastSeen = NOW() WHERE id IN (", "?", ")" }
+    };
+
+    const size_t COUNT = static_cast<size_t>(Command::Count);
+    // Names are hashed into SLOTS slots. The static_assert below fails if two names share a slot,
+    // then SLOTS has to grow, a lookup is always one hash and one string compare.
+    const size_t SLOTS = 64;
+
+    constexpr uint32_t hash(const char* str, uint32_t value = 2166136261u) {
+        return *str == '\0' ? value : hash(str + 1, (value ^ static_cast<uint8_t>(*str)) * 16777619u);
+    }
+
+    inline uint32_t hash(const StringRef& str) {
+        uint32_t value = 2166136261u;
+        for (size_t i = 0; i < str.size; i++) {
+            value = (value ^ static_cast<uint8_t>(str.data[i])) * 16777619u;
+        }
+        return value;
+    }
+
+    constexpr size_t getSlot(const char* name) {
+        return hash(name) & (SLOTS - 1);
+    }
+
+    constexpr bool isOrdered(size_t i = 0) {
+        return i >= COUNT || (static_cast<size_t>(DEFINITIONS[i].command) == i && isOrdered(i + 1));
+    }
+
+    constexpr bool collides(size_t i, size_t j) {
+        return j < COUNT && (getSlot(DEFINITIONS[i].name) == getSlot(DEFINITIONS[j].name) || collides(i, j + 1));
+    }
+
+    constexpr bool isCollisionFree(size_t i = 1) {
+        return i >= COUNT || (!collides(i, i + 1) && isCollisionFree(i + 1));
+    }
+
+    static_assert(sizeof(DEFINITIONS) / sizeof(DEFINITIONS[0]) == COUNT, "Every command needs a definition.");
+    static_assert(isOrdered(), "Definitions must be in the order of Command.");
+    static_assert(isCollisionFree(), "Two command names hash to the same slot, increase SLOTS.");
+
+    constexpr Command findInSlot(size_t slot, size_t i = 1) {
+        return i >= COUNT ? Command::Unknown : getSlot(DEFINITIONS[i].name) == slot ? DEFINITIONS[i].command : findInSlot(slot, i + 1);
+    }
+
+    template <size_t... I> struct Indices {};
+    template <size_t N, size_t... I> struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+    template <size_t... I> struct MakeIndices<0, I...> { typedef Indices<I...> Type; };
+
+    template <size_t... I>
+    constexpr std::array<Command, sizeof...(I)> makeSlotTable(Indices<I...>) {
+        return std::array<Command, sizeof...(I)>{ { findInSlot(I)... } };
+    }
+
+    constexpr std::array<Command, SLOTS> SLOT_TABLE = makeSlotTable(MakeIndices<SLOTS>::Type());
+
+    inline const Definition& get(Command command) {
+        return DEFINITIONS[static_cast<size_t>(command)];
+    }
+
+    inline Command find(const StringRef& name) {
+        Command command = SLOT_TABLE[hash(name) & (SLOTS - 1)];
+        const char* candidate = DEFINITIONS[static_cast<size_t>(command)].name;
+        if (command == Command::Unknown || std::strncmp(candidate, name.data, name.size) != 0 || candidate[name.size] != '\0') {
+            return Command::Unknown;
+        }
+        return command;
+    }
+
+    // A param decoded by its declared type, numbers that do not parse are 0.
+    struct Value {
+        StringRef text;
+        uint32_t integer;
+        double number;
+    };
+
+    // Fills one value per declared param, false if the param count does not match the definition.
+    bool decode(const Request& request, Value* values);
+
+} // namespace commands
+} // namespace r3
+
+#endif // COMMANDS_H
@@ -0,0 +1,27 @@
+#ifndef DICTIONARY_H
+#define DICTIONARY_H
+
+#include "sink.h"
+
+#include <string>
+#include <vector>
+
+
+namespace r3 {
+namespace dictionary {
+
+    // Event types and player ids are written as small integer keys from the lookup tables of the
+    // sink. Each writer keeps the keys it has seen, so encoding an event only needs the database
+    // the first time a type or player shows up.
+    void initialize(size_t workers);
+    void finalize();
+    bool isEnabled();
+    // Reloads the keys of worker from the lookup tables, called after each connect. Throws Poco::Data::DataException.
+    void load(size_t worker, sink::Sink& sink);
+    // Sets typeKey and playerKey of rows, adding new names to the lookup tables. Throws Poco::Data::DataException.
+    void encode(size_t worker, sink::Sink& sink, std::vector<sink::EventRow>& rows);
+
+} // namespace dictionary
+} // namespace r3
+
+#endif // DICTIONARY_H
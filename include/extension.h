@@ -1,24 +1,80 @@
 #ifndef EXTENSION_H
 #define EXTENSION_H
 
+#include "commands.h"
+#include "remote.h"
 #include "sql.h"
-#include "Queue/Queue.h"
+#include "tokenizer.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
 
 
 #define R3_EXTENSION_VERSION       "1.0.0"
 
 namespace r3 {
 
-    const std::string REQUEST_COMMAND_POISON = "poison";
-
     const std::string RESPONSE_TYPE_ERROR = "error";
     const std::string RESPONSE_TYPE_OK = "ok";
+    const std::string RESPONSE_TYPE_PENDING = "pending";
+    const std::string RESPONSE_TYPE_PARTIAL = "partial";
 
     const std::string EMPTY_SQF_DATA = "\"\"";
 
-    struct Request {
-        std::string command;
-        std::vector<std::string> params;
+    // Params are stored back to back in one buffer, param 0 is the command name. Requests are
+    // moved from call() to the writers and recycled afterwards, so the buffers keep their capacity.
+    // A StringRef returned by param() is invalidated by the next add().
+    class Request {
+    public:
+        Command command;
+        uint32_t ticket;
+        uint64_t enqueued;
+        // Non zero if the request is sampled for tracing.
+        uint32_t traceId;
+        // Non zero if the request was read from the journal, its record is consumed once the request is recycled.
+        uint64_t journalRecord;
+        // Records of journaled requests coalesced into this one, consumed along with journalRecord.
+        std::vector<uint64_t> coalescedRecords;
+
+        Request() : command(Command::Unknown), ticket(0), enqueued(0), traceId(0), journalRecord(0) {}
+        explicit Request(Command command_) : command(command_), ticket(0), enqueued(0), traceId(0), journalRecord(0) {}
+
+        size_t size() const { return offsets_.empty() ? 0 : offsets_.size() - 1; }
+        StringRef param(size_t index) const { return StringRef(buffer_.data() + offsets_[index], offsets_[index + 1] - offsets_[index]); }
+        std::string str(size_t index) const { return param(index).str(); }
+
+        void add(const char* data, size_t size) {
+            if (offsets_.empty()) { offsets_.push_back(0); }
+            buffer_.append(data, size);
+            offsets_.push_back(static_cast<uint32_t>(buffer_.size()));
+        }
+        void add(const char* param) { add(param, std::strlen(param)); }
+        void add(const StringRef& param) { add(param.data, param.size); }
+        void add(const std::string& param) { add(param.data(), param.size()); }
+
+        // Leaves the journal records of the request to be read again on the next start.
+        void keepJournalRecords() {
+            journalRecord = 0;
+            coalescedRecords.clear();
+        }
+
+        void clear() {
+            command = Command::Unknown;
+            ticket = 0;
+            enqueued = 0;
+            traceId = 0;
+            journalRecord = 0;
+            coalescedRecords.clear();
+            buffer_.clear();
+            offsets_.clear();
+        }
+
+    private:
+        std::string buffer_;
+        std::vector<uint32_t> offsets_;
     };
 
     struct Response {
@@ -28,10 +84,15 @@ namespace r3 {
 
 namespace extension {
 
-    bool initialize();
+    bool initialize(remote::Side side = remote::Side::Extension);
     void finalize();
     void call(char *output, int outputSize, const char *function);
-    Request popRequest();
+    int callArgs(char *output, int outputSize, const char *function, const char **argv, int argc);
+    // Runs the r3_writer daemon: requests from the writer ring are written until stopping is set.
+    void runWriter(const std::atomic<bool>& stopping);
+    bool popRequest(size_t worker, Request& request, const std::chrono::milliseconds& timeout);
+    void setResult(uint32_t ticket, const Response& response);
+    void recycle(std::vector<Request>& batch);
 
 } // namespace extension
 } // namespace r3
@@ -0,0 +1,33 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+namespace r3 {
+
+    class Request;
+
+namespace journal {
+
+    bool initialize(const std::string& folder_, size_t segmentSize_);
+    void finalize();
+    bool isEnabled();
+    bool empty();
+    uint64_t size();
+    bool append(const Request& request);
+    // Read requests carry their record, which stays in the journal until the request is acknowledged.
+    size_t read(std::vector<Request>& requests, size_t maxRequests);
+    // Marks the record of a request read from the journal as consumed, once it was written or journaled again.
+    void acknowledge(const Request& request);
+    // A record is [uint32 length][uint16 param count]([uint32 size][bytes])*, encode leaves the length 0
+    // for the caller to fill in and decode starts after it. The writer daemon's ring reuses the format.
+    void encode(const Request& request, std::string& buffer);
+    bool decode(const char* position, const char* end, Request& request);
+
+} // namespace journal
+} // namespace r3
+
+#endif // JOURNAL_H
@@ -3,11 +3,37 @@
 
 #include "spdlog/spdlog.h"
 
+#include <chrono>
+
+// Trace and debug call sites below this level are compiled out: 0 keeps all, 1 drops trace, 2 drops trace and debug.
+#ifndef R3_LOG_COMPILED_LEVEL
+#define R3_LOG_COMPILED_LEVEL 0
+#endif
+
+// Unlike logger->debug(), the arguments are not evaluated when the level is disabled.
+#if R3_LOG_COMPILED_LEVEL < 1
+#define R3_LOG_TRACE(...) do { if (r3::log::logger->should_log(spdlog::level::trace)) { r3::log::logger->trace(__VA_ARGS__); } } while (0)
+#else
+#define R3_LOG_TRACE(...) do {} while (0)
+#endif
+
+#if R3_LOG_COMPILED_LEVEL < 2
+#define R3_LOG_DEBUG(...) do { if (r3::log::logger->should_log(spdlog::level::debug)) { r3::log::logger->debug(__VA_ARGS__); } } while (0)
+#else
+#define R3_LOG_DEBUG(...) do {} while (0)
+#endif
+
 namespace r3 {
 namespace log {
     extern std::shared_ptr<spdlog::logger> logger;
 
-    bool initialze(const std::string& extensionFolder, const std::string& logLevel);
+    const std::string DEFAULT_FLUSH_LEVEL = "warn";
+    const size_t DEFAULT_QUEUE_SIZE = 8192;
+    const std::chrono::milliseconds DEFAULT_FLUSH_INTERVAL(1000);
+
+    // Messages are written by a background thread, which flushes every flushInterval and after any message at flushLevel or above.
+    bool initialze(const std::string& extensionFolder, const std::string& logLevel, const std::string& flushLevel = DEFAULT_FLUSH_LEVEL,
+        size_t queueSize = DEFAULT_QUEUE_SIZE, const std::chrono::milliseconds& flushInterval = DEFAULT_FLUSH_INTERVAL);
     void finalize();
 
 } // namespace log
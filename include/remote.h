@@ -0,0 +1,44 @@
+#ifndef REMOTE_H
+#define REMOTE_H
+
+#include <cstdint>
+#include <string>
+
+
+namespace r3 {
+
+    class Request;
+    struct Response;
+
+namespace remote {
+
+    // The extension hands requests to the r3_writer daemon through a ring in a memory mapped file
+    // and the daemon hands ticket results back through a second one.
+    enum class Side {
+        Extension,
+        Writer
+    };
+
+    bool initialize(const std::string& extensionFolder, size_t ringSize, Side side);
+    void finalize();
+    bool isEnabled();
+    // True while the daemon's heartbeat is recent, the extension writes in process otherwise.
+    bool isWriterAlive();
+    // True while this process reads the request ring. The daemon claims it on start, the extension
+    // with takeOver, and the last claim wins.
+    bool isOwner();
+    // Claims the request ring for the extension, false if a daemon claimed it at the same time.
+    bool takeOver();
+    bool push(const Request& request);
+    // Returns false while this process does not own the request ring.
+    bool pop(Request& request);
+    bool pushResult(uint32_t ticket, const Response& response);
+    bool popResult(uint32_t& ticket, Response& response);
+    // Called regularly by the daemon, also publishes its database state for the status command.
+    void heartbeat(const std::string& state, size_t connectedWorkers, size_t poolSize);
+    void getWriterStatus(std::string& state, size_t& connectedWorkers, size_t& poolSize);
+
+} // namespace remote
+} // namespace r3
+
+#endif // REMOTE_H
@@ -0,0 +1,270 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "util.h"
+
+
+namespace r3 {
+
+    enum class OverflowPolicy {
+        DropNewest,
+        DropOldest,
+        Spill
+    };
+
+    inline OverflowPolicy parseOverflowPolicy(const std::string& policy) {
+        if (policy == "oldest") { return OverflowPolicy::DropOldest; }
+        if (policy == "spill") { return OverflowPolicy::Spill; }
+        return OverflowPolicy::DropNewest;
+    }
+
+    // Bounded, preallocated multi-producer queue (Dmitry Vyukov's sequence-per-cell
+    // algorithm). Producers never take a lock unless the consumer is asleep or the
+    // ring is full and the policy is DropOldest. The algorithm is also safe with several
+    // consumers, which DropOldest relies on to evict from the producer side.
+    // DropOldest hands each evicted item to evict, which returns false if the item must not be
+    // dropped. Such items are retained and served before the ring, at most capacity of them,
+    // after that new items are dropped instead. Without evict every item may be dropped.
+    // Spill hands an item that does not fit to spill, which returns true if it took the item
+    // somewhere bounded. The item is dropped otherwise, like with DropNewest.
+    template <typename T>
+    class RingBuffer {
+    public:
+        RingBuffer(size_t capacity, OverflowPolicy policy, std::function<bool(T&)> evict = nullptr, std::function<bool(T&)> spill = nullptr) :
+            capacity_(util::roundUpToPowerOfTwo(capacity)),
+            mask_(capacity_ - 1),
+            cells_(new Cell[capacity_]),
+            policy_(policy),
+            evict_(std::move(evict)),
+            spill_(std::move(spill)),
+            enqueuePos_(0),
+            dequeuePos_(0),
+            retainedSize_(0),
+            highWater_(0),
+            sleeping_(false),
+            droppedNewest_(0),
+            droppedOldest_(0),
+            spilled_(0) {
+            for (size_t i = 0; i < capacity_; i++) {
+                cells_[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        RingBuffer(const RingBuffer&) = delete;
+        RingBuffer& operator=(const RingBuffer&) = delete;
+
+        // Applies the overflow policy when the ring is full. Returns false if the item was dropped.
+        bool push(T&& item) {
+            if (tryPush(item)) {
+                updateHighWater();
+                notify();
+                return true;
+            }
+            switch (policy_) {
+            case OverflowPolicy::DropNewest:
+                droppedNewest_++;
+                return false;
+            case OverflowPolicy::DropOldest:
+                while (!tryPush(item)) {
+                    if (retainedSize_.load(std::memory_order_acquire) >= capacity_) {
+                        droppedNewest_++;
+                        return false;
+                    }
+                    T oldest;
+                    if (!tryPop(oldest)) { continue; }
+                    if (!evict_ || evict_(oldest)) {
+                        droppedOldest_++;
+                        continue;
+                    }
+                    std::lock_guard<std::mutex> lock(retainedMutex_);
+                    retained_.push_back(std::move(oldest));
+                    retainedSize_.fetch_add(1, std::memory_order_release);
+                }
+                updateHighWater();
+                notify();
+                return true;
+            case OverflowPolicy::Spill:
+                if (spill_ && spill_(item)) {
+                    spilled_++;
+                    return true;
+                }
+                droppedNewest_++;
+                return false;
+            }
+            return false;
+        }
+
+        // Ignores the overflow policy and waits up to timeout for a free cell, for items that must not be dropped.
+        // Returns false if the ring stayed full, the item is left with the caller then.
+        bool pushWait(T&& item, const std::chrono::milliseconds& timeout) {
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            while (!tryPush(item)) {
+                if (std::chrono::steady_clock::now() >= deadline) { return false; }
+                std::this_thread::yield();
+            }
+            notify();
+            return true;
+        }
+
+        T pop() {
+            T item;
+            while (!pop(item, std::chrono::milliseconds(1000))) {}
+            return item;
+        }
+
+        bool pop(T& item, const std::chrono::milliseconds& timeout) {
+            if (tryPopAny(item)) { return true; }
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            std::unique_lock<std::mutex> lock(waitMutex_);
+            while (true) {
+                sleeping_.store(true);
+                if (tryPopAny(item)) {
+                    sleeping_.store(false);
+                    return true;
+                }
+                if (cond_.wait_until(lock, deadline) == std::cv_status::timeout) {
+                    sleeping_.store(false);
+                    return tryPopAny(item);
+                }
+            }
+        }
+
+        // Never blocks, returns false if the queue is empty.
+        bool poll(T& item) {
+            return tryPopAny(item);
+        }
+
+        size_t size() const {
+            size_t enqueued = enqueuePos_.load(std::memory_order_relaxed);
+            size_t dequeued = dequeuePos_.load(std::memory_order_relaxed);
+            size_t ringSize = enqueued > dequeued ? enqueued - dequeued : 0;
+            return retainedSize_.load(std::memory_order_relaxed) + ringSize;
+        }
+
+        size_t highWaterMark() const { return highWater_; }
+        size_t capacity() const { return capacity_; }
+        OverflowPolicy policy() const { return policy_; }
+        uint64_t droppedNewest() const { return droppedNewest_; }
+        uint64_t droppedOldest() const { return droppedOldest_; }
+        uint64_t spilled() const { return spilled_; }
+
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T data;
+        };
+
+        bool tryPush(T& item) {
+            size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+            while (true) {
+                Cell& cell = cells_[pos & mask_];
+                size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+                if (diff == 0) {
+                    if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        cell.data = std::move(item);
+                        cell.sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0) {
+                    return false;
+                }
+                else {
+                    pos = enqueuePos_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        bool tryPop(T& item) {
+            size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+            while (true) {
+                Cell& cell = cells_[pos & mask_];
+                size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+                if (diff == 0) {
+                    if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        item = std::move(cell.data);
+                        cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0) {
+                    return false;
+                }
+                else {
+                    pos = dequeuePos_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Retained items were evicted from the head of the ring, so they are served first.
+        bool tryPopAny(T& item) {
+            if (retainedSize_.load(std::memory_order_acquire) > 0) {
+                std::lock_guard<std::mutex> lock(retainedMutex_);
+                if (!retained_.empty()) {
+                    item = std::move(retained_.front());
+                    retained_.pop_front();
+                    retainedSize_.fetch_sub(1, std::memory_order_release);
+                    return true;
+                }
+            }
+            return tryPop(item);
+        }
+
+        void updateHighWater() {
+            size_t current = size();
+            size_t highWater = highWater_.load(std::memory_order_relaxed);
+            while (current > highWater && !highWater_.compare_exchange_weak(highWater, current, std::memory_order_relaxed)) {}
+        }
+
+        void notify() {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (sleeping_.load()) {
+                std::lock_guard<std::mutex> lock(waitMutex_);
+                cond_.notify_one();
+            }
+        }
+
+        const size_t capacity_;
+        const size_t mask_;
+        std::unique_ptr<Cell[]> cells_;
+        const OverflowPolicy policy_;
+        const std::function<bool(T&)> evict_;
+        const std::function<bool(T&)> spill_;
+
+        // Padding keeps producer and consumer positions on separate cache lines.
+        char padding0_[64];
+        std::atomic<size_t> enqueuePos_;
+        char padding1_[64];
+        std::atomic<size_t> dequeuePos_;
+        char padding2_[64];
+
+        std::mutex retainedMutex_;
+        std::deque<T> retained_;
+        std::atomic<size_t> retainedSize_;
+        std::atomic<size_t> highWater_;
+
+        std::mutex waitMutex_;
+        std::condition_variable cond_;
+        std::atomic<bool> sleeping_;
+
+        std::atomic<uint64_t> droppedNewest_;
+        std::atomic<uint64_t> droppedOldest_;
+        std::atomic<uint64_t> spilled_;
+    };
+
+} // namespace r3
+
+#endif // RINGBUFFER_H
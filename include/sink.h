@@ -0,0 +1,157 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include "Poco/Data/DataException.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace r3 {
+namespace sink {
+
+    struct ReplayRow {
+        uint32_t id;
+        std::string missionName;
+        std::string map;
+        double dayTime;
+        std::string addonVersion;
+    };
+
+    struct PlayerRow {
+        std::string id;
+        std::string name;
+    };
+
+    // Updates lastSeen of a known player.
+    struct TouchRow {
+        std::string id;
+    };
+
+    struct EventRow {
+        uint32_t replayId;
+        std::string playerId;
+        std::string type;
+        std::string value;
+        double missionTime;
+        // Dictionary keys of type and playerId, only set when events are dictionary encoded.
+        uint32_t typeKey;
+        uint32_t playerKey;
+    };
+
+    // Lookup tables of the dictionary encoding, see dictionary.h.
+    enum class Dictionary : uint8_t {
+        EventType,
+        Player,
+        Count
+    };
+
+    // Where the writers put their rows. Each worker only uses its own connection, so a sink
+    // needs no locking between workers. Failures are thrown as Poco::Data::DataException.
+    class Sink {
+    public:
+        virtual ~Sink() {}
+
+        // Called before the workers connect, workers is the pool size and batchSize the most rows of one insert.
+        // With keyedEvents events are written with typeKey and playerKey instead of type and playerId.
+        virtual void initialize(size_t workers, size_t batchSize, bool keyedEvents) = 0;
+        virtual void start() = 0;
+        virtual void finalize() = 0;
+        // Where the rows go, for the log.
+        virtual std::string describe() const = 0;
+        // Opens a fresh connection for worker, the old one and everything prepared on it is dropped.
+        virtual void connect(size_t worker) = 0;
+        // Drops everything prepared on the connection of worker, used after an error.
+        virtual void reset(size_t worker) = 0;
+        // True if the connection of worker is gone and must be opened again.
+        virtual bool isSessionLost(const Poco::Data::DataException& e) const = 0;
+
+        virtual void begin(size_t worker) = 0;
+        virtual void commit(size_t worker) = 0;
+        virtual void rollback(size_t worker) = 0;
+        virtual void insert(size_t worker, const std::vector<ReplayRow>& rows) = 0;
+        virtual void insert(size_t worker, const std::vector<PlayerRow>& rows) = 0;
+        virtual void insert(size_t worker, const std::vector<TouchRow>& rows) = 0;
+        virtual void insert(size_t worker, const std::vector<EventRow>& rows) = 0;
+        // Inserts a replay without an id and returns the one it got.
+        virtual uint32_t insertReplay(size_t worker, const ReplayRow& row) = 0;
+        // Moves the replay id sequence count ids on, returns the end of the reserved block or 0 if there is no sequence.
+        virtual uint32_t reserveReplayIds(size_t worker, uint32_t count) = 0;
+        // Bulk loads a staging file holding rows event rows, see staging.cpp for the format.
+        virtual void loadEvents(size_t worker, const std::string& path, size_t rows) = 0;
+        // Adds every entry of the lookup table of dictionary to keys.
+        virtual void loadKeys(size_t worker, Dictionary dictionary, std::unordered_map<std::string, uint32_t>& keys) = 0;
+        // Returns the key of name, which is added to the lookup table if it is not in there yet.
+        virtual uint32_t insertKey(size_t worker, Dictionary dictionary, const std::string& name) = 0;
+    };
+
+    std::unique_ptr<Sink> createMySQL(const std::string& host, uint32_t port, const std::string& database, const std::string& user, const std::string& password, size_t timeout);
+
+    // Keeps rows in memory instead of writing them anywhere, for benchmarks and running without a
+    // database. With keepRows false only the rows are counted.
+    class MemorySink : public Sink {
+    public:
+        explicit MemorySink(bool keepRows);
+
+        void initialize(size_t workers, size_t batchSize, bool keyedEvents) override;
+        void start() override;
+        void finalize() override;
+        std::string describe() const override;
+        void connect(size_t worker) override;
+        void reset(size_t worker) override;
+        bool isSessionLost(const Poco::Data::DataException& e) const override;
+
+        void begin(size_t worker) override;
+        void commit(size_t worker) override;
+        void rollback(size_t worker) override;
+        void insert(size_t worker, const std::vector<ReplayRow>& rows) override;
+        void insert(size_t worker, const std::vector<PlayerRow>& rows) override;
+        void insert(size_t worker, const std::vector<TouchRow>& rows) override;
+        void insert(size_t worker, const std::vector<EventRow>& rows) override;
+        uint32_t insertReplay(size_t worker, const ReplayRow& row) override;
+        uint32_t reserveReplayIds(size_t worker, uint32_t count) override;
+        // Loaded rows are counted but not kept.
+        void loadEvents(size_t worker, const std::string& path, size_t rows) override;
+        void loadKeys(size_t worker, Dictionary dictionary, std::unordered_map<std::string, uint32_t>& keys) override;
+        uint32_t insertKey(size_t worker, Dictionary dictionary, const std::string& name) override;
+
+        // Committed rows of all workers, safe to read while the workers run.
+        uint64_t getCommittedRows() const;
+        // Only safe once the workers stopped.
+        const std::vector<EventRow>& getEvents(size_t worker) const;
+
+    private:
+        // Rows of an open transaction are only counted, and kept if keepRows_ is set, on commit.
+        struct Worker {
+            bool inTransaction;
+            size_t pendingRows;
+            std::vector<ReplayRow> replays;
+            std::vector<PlayerRow> players;
+            std::vector<EventRow> events;
+            size_t committedReplays;
+            size_t committedPlayers;
+            size_t committedEvents;
+        };
+
+        template <typename Row>
+        void add(Worker& worker, std::vector<Row>& table, const std::vector<Row>& rows);
+        void autoCommit(Worker& worker);
+
+        const bool keepRows_;
+        std::vector<Worker> workers_;
+        std::atomic<uint64_t> committedRows_;
+        std::mutex replayIdsMutex_;
+        uint32_t nextReplayId_;
+        std::mutex keysMutex_;
+        std::unordered_map<std::string, uint32_t> keys_[static_cast<size_t>(Dictionary::Count)];
+    };
+
+} // namespace sink
+} // namespace r3
+
+#endif // SINK_H
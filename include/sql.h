@@ -1,24 +1,49 @@
 #ifndef SQL_H
 #define SQL_H
 
+#include "sink.h"
+#include "tokenizer.h"
+
+#include <memory>
 #include <string>
 #include <mutex>
+#include <vector>
 
 
 namespace r3 {
 
-    struct Request;
+    class Request;
     struct Response;
 
 namespace sql {
 
-    bool initialize(const std::string& host_, uint32_t port_, const std::string& database_, const std::string& user_, const std::string& password_, size_t timeout_);
+    enum class ConnectionState {
+        Disconnected,
+        Connecting,
+        Connected,
+        Backoff
+    };
+
+    // The writers put their rows into sink_, which is dropped again by finalize. With dictionary_
+    // events are written with dictionary keys, see dictionary.h.
+    bool initialize(std::unique_ptr<sink::Sink> sink_, size_t batchSize_, size_t batchLinger_, size_t poolSize_, size_t reconnectMin_, size_t reconnectMax_, size_t replayIdBlock_, bool dictionary_);
     void finalize();
-    void run();
-    std::mutex& getSessionMutex();
-    bool isConnected();
-    std::string connect();
-    Response processRequest(const Request& request);
+    size_t getPoolSize();
+    sink::Sink& getSink();
+    void run(size_t worker);
+    void start();
+    void stop();
+    // False once the worker returned from run, its queue is not read anymore then.
+    bool isRunning(size_t worker);
+    bool isStarted();
+    bool isAvailable();
+    std::string getState();
+    size_t getConnectedWorkers();
+    std::string getLastError();
+    bool takeReplayId(uint32_t& id);
+    Response processRequest(size_t worker, const Request& request);
+    // Splits a 'player' or 'event' request whose params were passed unsplit, expanded is scratch space.
+    void expandDeferred(Request& request, Request& expanded, std::vector<StringRef>& tokens);
 
 } // namespace sql
 } // namespace r3
@@ -0,0 +1,38 @@
+#ifndef STAGING_H
+#define STAGING_H
+
+#include "sink.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+
+namespace r3 {
+namespace staging {
+
+    // Event rows bulk loaded from tab separated staging files, one open file per writer. A file
+    // is closed once it reaches maxSize bytes or is interval old and only removed after it was
+    // loaded, files left by a crash or a failed load are loaded again after a restart.
+    bool initialize(const std::string& folder_, size_t workers, size_t maxSize, const std::chrono::milliseconds& interval);
+    void finalize();
+    bool isEnabled();
+    // True while loads keep failing, new rows are inserted then and staged files are still retried.
+    bool isSuspended();
+    // Appends rows to the open file of worker, false if they could not be written.
+    bool append(size_t worker, const std::vector<sink::EventRow>& rows);
+    // Closes the open file of worker if it is full or old enough, or if force is set.
+    void rotate(size_t worker, bool force);
+    // Takes the next closed file that is due to be loaded, false if there is none.
+    bool take(std::string& path, size_t& rows);
+    // Marks the file loaded and removes it, a marked file is never loaded again. Resumes staging if it was suspended.
+    void loaded(const std::string& path);
+    // Hands back a file that failed to load, it is taken again after a retry interval. Returns true if
+    // this failure suspended staging.
+    bool failed(const std::string& path, size_t rows);
+    size_t pending();
+
+} // namespace staging
+} // namespace r3
+
+#endif // STAGING_H
@@ -0,0 +1,35 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <string>
+
+
+namespace r3 {
+namespace stats {
+
+    enum Command {
+        COMMAND_REPLAY,
+        COMMAND_PLAYER,
+        COMMAND_EVENT,
+        COMMAND_COUNT
+    };
+
+    uint64_t now();
+    void countRequest(Command command);
+    void countRows(size_t rows);
+    void countError();
+    void countReconnect();
+    void recordCallTime(uint64_t nanoseconds);
+    void recordLatency(uint64_t nanoseconds);
+    // Call to commit latency of the most recently written request.
+    uint64_t getRecentLatency();
+    void countPrioritized();
+    void countShed();
+    uint64_t getShed();
+    std::string format(size_t depth, size_t highWater, uint64_t journaled, uint64_t dropped);
+
+} // namespace stats
+} // namespace r3
+
+#endif // STATS_H
@@ -0,0 +1,38 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+namespace r3 {
+
+    struct StringRef {
+        const char* data;
+        size_t size;
+
+        StringRef() : data(nullptr), size(0) {}
+        StringRef(const char* data_, size_t size_) : data(data_), size(size_) {}
+
+        bool empty() const { return size == 0; }
+        std::string str() const { return std::string(data, size); }
+
+        bool operator==(const char* other) const {
+            return std::strlen(other) == size && std::memcmp(data, other, size) == 0;
+        }
+        bool operator!=(const char* other) const { return !(*this == other); }
+    };
+
+namespace tokenizer {
+
+    void compile(const std::string& separator);
+    bool isLiteral();
+    void split(const char* str, size_t length, std::vector<StringRef>& tokens);
+    // Offset of the first literal separator in str, or length if there is none or the separator is a regex.
+    size_t find(const char* str, size_t length);
+
+} // namespace tokenizer
+} // namespace r3
+
+#endif // TOKENIZER_H
@@ -0,0 +1,29 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+
+namespace r3 {
+namespace trace {
+
+    // Spans of sampled requests, written as Chrome trace event JSON to the 'trace' folder next to
+    // the config file. Open the file in chrome://tracing or ui.perfetto.dev. Times are microseconds.
+    bool initialize(const std::string& extensionFolder, uint32_t sampleRate, const std::chrono::milliseconds& flushInterval);
+    void finalize();
+    bool isEnabled();
+    uint64_t now();
+    // A trace id for one in sampleRate calls, 0 for the others. Only called by the game thread.
+    uint32_t sample();
+    // Names must be string literals, events keep the pointer.
+    void complete(const char* name, uint32_t id, uint64_t start, uint64_t end);
+    void begin(const char* name, uint32_t id, uint64_t time);
+    void end(const char* name, uint32_t id, uint64_t time);
+    void setThreadName(const std::string& name);
+
+} // namespace trace
+} // namespace r3
+
+#endif // TRACE_H
@@ -0,0 +1,29 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+namespace r3 {
+namespace util {
+
+    // The smallest power of two of at least value, and at least 2.
+    inline size_t roundUpToPowerOfTwo(size_t value) {
+        size_t result = 2;
+        while (result < value) { result <<= 1; }
+        return result;
+    }
+
+    // The value at percentile of sorted nanoseconds, in microseconds.
+    inline double getPercentile(const std::vector<uint64_t>& sorted, double percentile) {
+        if (sorted.empty()) { return 0; }
+        size_t index = static_cast<size_t>(percentile * (sorted.size() - 1));
+        return sorted[index] / 1e3;
+    }
+
+} // namespace util
+} // namespace r3
+
+#endif // UTIL_H
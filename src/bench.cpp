@@ -0,0 +1,257 @@
+#include "extension.h"
+#include "log.h"
+#include "ringbuffer.h"
+#include "sink.h"
+#include "sql.h"
+#include "tokenizer.h"
+#include "util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Measures the hot path of the extension without a database: splitting, call() dispatch, the
+// request queue under contention, binding in processRequest and events per second from call()
+// to commit. Uses the config.properties of the extension folder, which must set r3.db.sink to
+// memory or null. The separator argument must match r3.sqf.separator.
+
+namespace {
+    const int OUTPUT_SIZE = 10240;
+    const size_t PAYLOAD_COUNT = 1024;
+    const size_t QUEUE_CAPACITY = 65536;
+    const std::chrono::seconds DRAIN_TIMEOUT(30);
+    const std::string DEFAULT_SEPARATOR = "&%`";
+    const size_t EVENT_TOKENS = 6;
+
+    typedef std::chrono::steady_clock Clock;
+
+    uint64_t elapsed(const Clock::time_point& start) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    }
+
+    void report(const std::string& name, size_t operations, uint64_t nanoseconds) {
+        double seconds = nanoseconds / 1e9;
+        std::cout << name << ": " << operations << " in " << seconds << " s, "
+            << (seconds > 0 ? operations / seconds : 0) << " ops/s, "
+            << (operations > 0 ? static_cast<double>(nanoseconds) / operations : 0) << " ns/op" << std::endl;
+    }
+
+    std::string makePosition(std::minstd_rand& random) {
+        std::uniform_real_distribution<double> coordinate(0, 30000);
+        return fmt::format("[{:.1f},{:.1f},{:.1f}]", coordinate(random), coordinate(random), coordinate(random) / 100);
+    }
+
+    // Mission shaped event calls: mostly position updates of a group of units, some shots and
+    // hits, a few vehicle updates. Values range from a few dozen bytes to about 2 KB.
+    std::vector<std::string> makePayloads(size_t count, const std::string& separator) {
+        std::minstd_rand random(42);
+        std::uniform_int_distribution<int> kind(0, 99);
+        std::uniform_int_distribution<int> units(5, 40);
+        std::uniform_int_distribution<int> player(0, 63);
+        std::vector<std::string> payloads;
+        payloads.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            int k = kind(random);
+            std::string type;
+            std::string value;
+            if (k < 60) {
+                type = "positions_infantry";
+                value = "[";
+                for (int unit = units(random); unit > 0; unit--) {
+                    value += fmt::format("{}[{},{},{}]", value.size() > 1 ? "," : "", unit, makePosition(random), unit * 7 % 360);
+                }
+                value += "]";
+            }
+            else if (k < 85) {
+                type = "fired";
+                value = fmt::format("[\"arifle_MX_F\",\"30Rnd_65x39_caseless_mag\",{}]", makePosition(random));
+            }
+            else if (k < 95) {
+                type = "hit";
+                value = fmt::format("[\"76561198000000{:03}\",\"B_Soldier_F\",\"head\",0.85,{},{}]", player(random), makePosition(random), makePosition(random));
+            }
+            else {
+                type = "positions_vehicles";
+                value = "[";
+                for (int vehicle = units(random) / 4 + 1; vehicle > 0; vehicle--) {
+                    value += fmt::format("{}[{},\"B_MRAP_01_F\",{},[1,2,3],0.9]", value.size() > 1 ? "," : "", vehicle, makePosition(random));
+                }
+                value += "]";
+            }
+            payloads.push_back(fmt::format("event{0}1{0}76561198000000{1:03}{0}{2}{0}{3}{0}{4:.2f}", separator, player(random), type, value, i * 0.5));
+        }
+        return payloads;
+    }
+
+    void benchSplit(const std::vector<std::string>& payloads, size_t events) {
+        std::vector<r3::StringRef> tokens;
+        size_t checksum = 0;
+        auto start = Clock::now();
+        for (size_t i = 0; i < events; i++) {
+            const std::string& payload = payloads[i % payloads.size()];
+            r3::tokenizer::split(payload.data(), payload.size(), tokens);
+            checksum += tokens.size();
+        }
+        report("split", events, elapsed(start));
+        if (checksum != events * EVENT_TOKENS) {
+            std::cout << "  unexpected token count " << checksum << std::endl;
+        }
+    }
+
+    // Returns false if an item did not arrive in time, only the items received are counted.
+    bool benchQueue(size_t producers, size_t events) {
+        r3::RingBuffer<r3::Request> queue(QUEUE_CAPACITY, r3::OverflowPolicy::DropNewest);
+        size_t perProducer = events / producers;
+        size_t expected = perProducer * producers;
+        std::atomic<bool> abandoned(false);
+        std::vector<std::thread> threads;
+        auto start = Clock::now();
+        for (size_t i = 0; i < producers; i++) {
+            threads.emplace_back([&queue, &abandoned, perProducer]() {
+                for (size_t j = 0; j < perProducer; j++) {
+                    r3::Request request(r3::Command::Event);
+                    while (!queue.push(std::move(request))) {
+                        if (abandoned) { return; }
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+        r3::Request request;
+        size_t received = 0;
+        while (received < expected && queue.pop(request, std::chrono::milliseconds(1000))) {
+            received++;
+        }
+        uint64_t nanoseconds = elapsed(start);
+        abandoned = received < expected;
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        report(fmt::format("queue {} producers", producers), received, nanoseconds);
+        if (received < expected) {
+            std::cout << "  timed out after " << received << " of " << expected << " items" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Runs before the writers connect, so the bench thread has worker 0 to itself.
+    void benchBinding(const std::vector<std::string>& payloads, size_t events) {
+        std::vector<r3::Request> requests(payloads.size());
+        std::vector<r3::StringRef> tokens;
+        for (size_t i = 0; i < payloads.size(); i++) {
+            r3::tokenizer::split(payloads[i].data(), payloads[i].size(), tokens);
+            requests[i].command = r3::Command::Event;
+            for (auto& token : tokens) {
+                requests[i].add(token);
+            }
+        }
+        size_t errors = 0;
+        auto start = Clock::now();
+        for (size_t i = 0; i < events; i++) {
+            r3::Response response = r3::sql::processRequest(0, requests[i % requests.size()]);
+            if (response.type != r3::RESPONSE_TYPE_OK) { errors++; }
+        }
+        report("processRequest", events, elapsed(start));
+        if (errors > 0) {
+            std::cout << "  " << errors << " errors" << std::endl;
+        }
+    }
+
+    void benchEndToEnd(const std::vector<std::string>& payloads, size_t events, r3::sink::MemorySink& sink) {
+        std::vector<char> output(OUTPUT_SIZE);
+        r3::extension::call(output.data(), OUTPUT_SIZE - 1, "connect");
+        auto connectDeadline = Clock::now() + DRAIN_TIMEOUT;
+        while (std::strstr(output.data(), "\"connected\"") == nullptr && Clock::now() < connectDeadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            r3::extension::call(output.data(), OUTPUT_SIZE - 1, "status");
+        }
+
+        std::vector<uint64_t> latencies;
+        latencies.reserve(events);
+        uint64_t committedBefore = sink.getCommittedRows();
+        auto start = Clock::now();
+        for (size_t i = 0; i < events; i++) {
+            auto callStart = Clock::now();
+            // Same as RVExtension, which reserves the last byte for the terminator.
+            r3::extension::call(output.data(), OUTPUT_SIZE - 1, payloads[i % payloads.size()].c_str());
+            latencies.push_back(elapsed(callStart));
+        }
+        uint64_t callNanoseconds = elapsed(start);
+
+        // Coalescing, shedding or a full queue can keep rows from arriving, so stop once no rows arrive for a while.
+        uint64_t committed = 0;
+        auto lastProgress = Clock::now();
+        while (committed < events && Clock::now() - lastProgress < DRAIN_TIMEOUT) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            uint64_t current = sink.getCommittedRows() - committedBefore;
+            if (current != committed) {
+                committed = current;
+                lastProgress = Clock::now();
+            }
+        }
+        uint64_t totalNanoseconds = elapsed(start);
+
+        std::sort(latencies.begin(), latencies.end());
+        report("call", events, callNanoseconds);
+        std::cout << "  latency p50 " << r3::util::getPercentile(latencies, 0.50) << " us, p99 " << r3::util::getPercentile(latencies, 0.99)
+            << " us, max " << r3::util::getPercentile(latencies, 1.0) << " us" << std::endl;
+        report("end to end", static_cast<size_t>(committed), totalNanoseconds);
+        if (committed < events) {
+            std::cout << "  only " << committed << " of " << events << " events were committed" << std::endl;
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t events = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+    std::string separator = argc > 2 ? argv[2] : DEFAULT_SEPARATOR;
+    if (events == 0) {
+        std::cerr << "Usage: r3_bench [events] [separator]" << std::endl
+            << "  separator must match r3.sqf.separator, default '" << DEFAULT_SEPARATOR << "'" << std::endl;
+        return 1;
+    }
+
+    if (!r3::extension::initialize()) {
+        std::cerr << "Failed to initialize the extension, see the extension log." << std::endl;
+        return 1;
+    }
+    r3::sink::MemorySink* sink = dynamic_cast<r3::sink::MemorySink*>(&r3::sql::getSink());
+    if (sink == nullptr) {
+        std::cerr << "r3_bench needs 'r3.db.sink=memory' or 'r3.db.sink=null' in the config file." << std::endl;
+        r3::extension::finalize();
+        return 1;
+    }
+
+    std::vector<std::string> payloads = makePayloads(PAYLOAD_COUNT, separator);
+    std::vector<r3::StringRef> tokens;
+    r3::tokenizer::split(payloads[0].data(), payloads[0].size(), tokens);
+    if (tokens.size() != EVENT_TOKENS) {
+        std::cerr << "Separator '" << separator << "' does not match r3.sqf.separator." << std::endl;
+        r3::extension::finalize();
+        return 1;
+    }
+    size_t payloadBytes = 0;
+    for (auto& payload : payloads) {
+        payloadBytes += payload.size();
+    }
+    std::cout << "Benchmarking " << events << " events, " << payloadBytes / payloads.size() << " bytes per call on average." << std::endl;
+
+    benchSplit(payloads, events);
+    bool queued = true;
+    for (size_t producers = 1; producers <= 8; producers *= 2) {
+        queued = benchQueue(producers, events) && queued;
+    }
+    benchBinding(payloads, events);
+    benchEndToEnd(payloads, events, *sink);
+
+    r3::extension::finalize();
+    return queued ? 0 : 1;
+}
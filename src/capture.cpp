@@ -0,0 +1,145 @@
+#include "capture.h"
+
+#include "log.h"
+#include "stats.h"
+
+#include "Poco/DateTimeFormatter.h"
+#include "Poco/Exception.h"
+#include "Poco/File.h"
+#include "Poco/LocalDateTime.h"
+#include "Poco/Path.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+
+namespace r3 {
+namespace capture {
+
+namespace {
+    const std::string CAPTURE_FOLDER = "capture";
+    const std::string CAPTURE_EXTENSION = ".r3t";
+    const char MAGIC[8] = { 'R', '3', 'T', 'R', 'A', 'C', 'E', '1' };
+    const size_t BUFFER_SIZE = 64 * 1024;
+
+    // A trace is MAGIC followed by one record per call: [varint microseconds since the
+    // previous call][varint length][function bytes]. Varints keep a typical record at
+    // the size of its function string plus three or four bytes.
+    bool enabled = false;
+    std::string path;
+    std::ofstream file;
+    std::string buffer;
+    uint64_t lastTime = 0;
+}
+
+    void writeVarint(std::string& buffer, uint64_t value) {
+        while (value >= 0x80) {
+            buffer.push_back(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        buffer.push_back(static_cast<char>(value));
+    }
+
+    bool readVarint(const char*& position, const char* end, uint64_t& value) {
+        value = 0;
+        for (size_t shift = 0; position < end && shift < 64; shift += 7) {
+            uint8_t byte = static_cast<uint8_t>(*position++);
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) { return true; }
+        }
+        return false;
+    }
+
+    void flush() {
+        if (buffer.empty()) { return; }
+        // The file is only created by the first flush, so a process that never calls the extension leaves no trace.
+        if (!file.is_open()) {
+            file.open(path, std::ios::binary | std::ios::trunc);
+            if (!file) {
+                log::logger->error("Failed to open capture file '{}', capture disabled!", path);
+                enabled = false;
+                buffer.clear();
+                return;
+            }
+            file.write(MAGIC, sizeof(MAGIC));
+        }
+        file.write(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+
+    bool initialize(const std::string& extensionFolder) {
+        std::string folder = fmt::format("{}{}{}", extensionFolder, Poco::Path::separator(), CAPTURE_FOLDER);
+        path = fmt::format("{}{}capture", folder, Poco::Path::separator());
+        Poco::DateTimeFormatter::append(path, Poco::LocalDateTime(), "_%Y-%m-%d_%H-%M-%S");
+        path += CAPTURE_EXTENSION;
+        try {
+            Poco::File(folder).createDirectories();
+        }
+        catch (Poco::Exception& e) {
+            log::logger->error("Failed to create capture folder '{}'! Error message: {}", folder, e.displayText());
+            return false;
+        }
+        buffer.reserve(BUFFER_SIZE);
+        lastTime = stats::now();
+        enabled = true;
+        log::logger->info("Capturing extension calls to '{}'.", path);
+        return true;
+    }
+
+    void finalize() {
+        if (!enabled) { return; }
+        flush();
+        if (file.is_open()) {
+            file.close();
+        }
+        enabled = false;
+    }
+
+    bool isEnabled() {
+        return enabled;
+    }
+
+    // Only called from the game thread, so the buffer needs no lock.
+    void record(const char* function, size_t length) {
+        if (!enabled) { return; }
+        uint64_t current = stats::now();
+        writeVarint(buffer, (current - lastTime) / 1000);
+        // Keep the remainder so rounding to microseconds does not drift over a long capture.
+        lastTime = current - (current - lastTime) % 1000;
+        writeVarint(buffer, length);
+        buffer.append(function, length);
+        if (buffer.size() >= BUFFER_SIZE) {
+            flush();
+        }
+    }
+
+    bool load(const std::string& path, std::vector<Entry>& entries) {
+        std::ifstream input(path, std::ios::binary);
+        if (!input) {
+            log::logger->error("Failed to open capture file '{}'!", path);
+            return false;
+        }
+        std::string data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+        if (data.size() < sizeof(MAGIC) || std::memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0) {
+            log::logger->error("File '{}' is not a capture file!", path);
+            return false;
+        }
+        const char* position = data.data() + sizeof(MAGIC);
+        const char* end = data.data() + data.size();
+        uint64_t time = 0;
+        while (position < end) {
+            uint64_t delta = 0, length = 0;
+            if (!readVarint(position, end, delta) || !readVarint(position, end, length) || static_cast<uint64_t>(end - position) < length) {
+                log::logger->warn("Capture file '{}' ends with a truncated record after '{}' calls.", path, entries.size());
+                break;
+            }
+            time += delta;
+            entries.push_back(Entry{ time, std::string(position, static_cast<size_t>(length)) });
+            position += length;
+        }
+        return true;
+    }
+
+} // namespace capture
+} // namespace r3
@@ -0,0 +1,228 @@
+#include "coalesce.h"
+
+#include "extension.h"
+#include "log.h"
+#include "sql.h"
+
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <unordered_map>
+
+
+namespace r3 {
+namespace coalesce {
+
+namespace {
+    struct Group {
+        Mode mode;
+        // The latest event, or the first one when merging.
+        Request request;
+        std::string values;
+        size_t count;
+        // Journal records of the events folded into the group, consumed once its row is written.
+        std::vector<uint64_t> records;
+    };
+
+    // Only touched by the worker that owns it, events of a replay always go to the same worker.
+    struct WorkerState {
+        std::unordered_map<std::string, Group> groups;
+        // Every group has the same window, so groups end in the order they were opened.
+        std::deque<std::pair<std::chrono::steady_clock::time_point, std::string>> deadlines;
+        std::string key;
+        Request expanded;
+        std::vector<StringRef> tokens;
+        std::vector<Request> discarded;
+    };
+
+    std::chrono::milliseconds window(0);
+    std::vector<std::pair<std::string, Mode>> modes;
+    std::vector<WorkerState> workerStates;
+    std::atomic<uint64_t> coalesced(0);
+}
+
+    Mode getMode(const StringRef& type) {
+        for (auto& mode : modes) {
+            if (mode.first.size() == type.size && std::memcmp(mode.first.data(), type.data, type.size) == 0) { return mode.second; }
+        }
+        return Mode::None;
+    }
+
+    bool isDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    // Matches SQF number literals like -1, 2.5 and 1e-3.
+    bool isNumber(const StringRef& value) {
+        size_t i = 0;
+        if (i < value.size && (value.data[i] == '-' || value.data[i] == '+')) { i++; }
+        size_t digits = 0;
+        for (; i < value.size && isDigit(value.data[i]); i++) { digits++; }
+        if (i < value.size && value.data[i] == '.') {
+            for (i++; i < value.size && isDigit(value.data[i]); i++) { digits++; }
+        }
+        if (digits == 0) { return false; }
+        if (i < value.size && (value.data[i] == 'e' || value.data[i] == 'E')) {
+            i++;
+            if (i < value.size && (value.data[i] == '-' || value.data[i] == '+')) { i++; }
+            size_t exponentDigits = 0;
+            for (; i < value.size && isDigit(value.data[i]); i++) { exponentDigits++; }
+            if (exponentDigits == 0) { return false; }
+        }
+        return i == value.size;
+    }
+
+    // Numbers and arrays are kept as they are, any other value becomes an SQF string with inner
+    // quotes doubled, so parseSimpleArray reads the merged values back.
+    void appendValue(std::string& values, const Request& request) {
+        values += values.empty() ? "[[" : ",[";
+        values.append(request.param(5).data, request.param(5).size);
+        values += ',';
+        StringRef value = request.param(4);
+        if (isNumber(value) || (value.size >= 2 && value.data[0] == '[' && value.data[value.size - 1] == ']')) {
+            values.append(value.data, value.size);
+        }
+        else {
+            values += '"';
+            for (size_t i = 0; i < value.size; i++) {
+                if (value.data[i] == '"') { values += '"'; }
+                values += value.data[i];
+            }
+            values += '"';
+        }
+        values += ']';
+    }
+
+    // Moves the journal records of a request folded into group over to it, recycling the request consumes none then.
+    void takeRecords(Group& group, Request& request) {
+        if (request.journalRecord != 0) {
+            group.records.push_back(request.journalRecord);
+        }
+        group.records.insert(group.records.end(), request.coalescedRecords.begin(), request.coalescedRecords.end());
+        request.keepJournalRecords();
+    }
+
+    void flush(Group& group, std::vector<Request>& batch) {
+        if (group.mode == Mode::Latest || group.count == 1) {
+            group.request.coalescedRecords.insert(group.request.coalescedRecords.end(), group.records.begin(), group.records.end());
+            batch.push_back(std::move(group.request));
+            return;
+        }
+        Request merged(Command::Event);
+        for (size_t i = 0; i < 4; i++) {
+            merged.add(group.request.param(i));
+        }
+        group.values += ']';
+        merged.add(group.values);
+        merged.add(group.request.param(5));
+        merged.ticket = group.request.ticket;
+        merged.enqueued = group.request.enqueued;
+        merged.traceId = group.request.traceId;
+        merged.journalRecord = group.request.journalRecord;
+        merged.coalescedRecords = std::move(group.records);
+        batch.push_back(std::move(merged));
+    }
+
+    void initialize(size_t workers, const std::chrono::milliseconds& window_, const std::vector<std::string>& latestTypes, const std::vector<std::string>& mergeTypes) {
+        window = window_;
+        modes.clear();
+        for (auto& type : latestTypes) {
+            modes.emplace_back(type, Mode::Latest);
+        }
+        for (auto& type : mergeTypes) {
+            modes.emplace_back(type, Mode::Merge);
+        }
+        workerStates.clear();
+        workerStates.resize(workers);
+        if (isEnabled()) {
+            log::logger->info("Coalescing '{}' event types over '{}' ms windows.", modes.size(), window.count());
+        }
+    }
+
+    void finalize() {
+        if (isEnabled()) {
+            log::logger->info("Coalesced '{}' events.", coalesced);
+        }
+        workerStates.clear();
+        modes.clear();
+    }
+
+    bool isEnabled() {
+        return window.count() > 0 && !modes.empty();
+    }
+
+    std::chrono::milliseconds getWindow() {
+        return window;
+    }
+
+    void process(size_t worker, std::vector<Request>& batch, bool flushAll) {
+        if (!isEnabled()) { return; }
+        WorkerState& state = workerStates[worker];
+        auto now = std::chrono::steady_clock::now();
+        size_t kept = 0;
+        for (size_t i = 0; i < batch.size(); i++) {
+            Request& request = batch[i];
+            sql::expandDeferred(request, state.expanded, state.tokens);
+            Mode mode = request.command == Command::Event && request.size() == 6 ? getMode(request.param(3)) : Mode::None;
+            if (mode == Mode::None) {
+                if (kept != i) {
+                    std::swap(batch[kept], request);
+                }
+                kept++;
+                continue;
+            }
+            state.key.clear();
+            for (size_t param = 1; param <= 3; param++) {
+                state.key.append(request.param(param).data, request.param(param).size);
+                state.key += '\n';
+            }
+            auto found = state.groups.find(state.key);
+            if (found == state.groups.end()) {
+                Group& group = state.groups[state.key];
+                group.mode = mode;
+                group.count = 1;
+                group.values.clear();
+                group.records.clear();
+                if (mode == Mode::Merge) {
+                    appendValue(group.values, request);
+                }
+                std::swap(group.request, request);
+                state.deadlines.emplace_back(now + window, state.key);
+                continue;
+            }
+            Group& group = found->second;
+            group.count++;
+            coalesced++;
+            if (mode == Mode::Latest) {
+                std::swap(group.request, request);
+            }
+            else {
+                appendValue(group.values, request);
+            }
+            takeRecords(group, request);
+        }
+        // Everything from kept on was swapped into a group or replaced by one.
+        for (size_t i = kept; i < batch.size(); i++) {
+            state.discarded.push_back(std::move(batch[i]));
+        }
+        batch.resize(kept);
+        extension::recycle(state.discarded);
+
+        while (!state.deadlines.empty() && (flushAll || state.deadlines.front().first <= now)) {
+            auto group = state.groups.find(state.deadlines.front().second);
+            flush(group->second, batch);
+            state.groups.erase(group);
+            state.deadlines.pop_front();
+        }
+    }
+
+    size_t pending(size_t worker) {
+        return workerStates[worker].groups.size();
+    }
+
+    uint64_t getCoalesced() {
+        return coalesced;
+    }
+
+} // namespace coalesce
+} // namespace r3
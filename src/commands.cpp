@@ -0,0 +1,30 @@
+#include "commands.h"
+
+#include "extension.h"
+
+#include "Poco/NumberParser.h"
+
+
+namespace r3 {
+namespace commands {
+
+    bool decode(const Request& request, Value* values) {
+        const Definition& definition = get(request.command);
+        if (definition.paramCount == VARIADIC || request.size() != definition.paramCount + 1u) { return false; }
+        for (size_t i = 0; i < definition.paramCount; i++) {
+            Value& value = values[i];
+            value.text = request.param(i + 1);
+            value.integer = 0;
+            value.number = 0;
+            if (definition.params[i] == Param::Unsigned && !Poco::NumberParser::tryParseUnsigned(value.text.str(), value.integer)) {
+                value.integer = 0;
+            }
+            else if (definition.params[i] == Param::Float && !Poco::NumberParser::tryParseFloat(value.text.str(), value.number)) {
+                value.number = 0;
+            }
+        }
+        return true;
+    }
+
+} // namespace commands
+} // namespace r3
@@ -0,0 +1,92 @@
+#include "dictionary.h"
+
+#include "log.h"
+
+#include <array>
+#include <mutex>
+#include <unordered_map>
+
+
+namespace r3 {
+namespace dictionary {
+
+namespace {
+    typedef std::unordered_map<std::string, uint32_t> Keys;
+    typedef std::array<Keys, static_cast<size_t>(sink::Dictionary::Count)> Dictionaries;
+
+    const char* const NAMES[] = { "event type", "player" };
+
+    bool enabled = false;
+    // Owned by the writer of the same index.
+    std::vector<Dictionaries> workerKeys;
+    // Keys any writer has seen, so a name new to one writer only goes to the database once.
+    std::mutex sharedMutex;
+    Dictionaries sharedKeys;
+}
+
+    uint32_t getKey(size_t worker, sink::Sink& sink, sink::Dictionary dictionary, const std::string& name) {
+        size_t index = static_cast<size_t>(dictionary);
+        Keys& keys = workerKeys[worker][index];
+        auto found = keys.find(name);
+        if (found != keys.end()) { return found->second; }
+        uint32_t key = 0;
+        {
+            std::lock_guard<std::mutex> lock(sharedMutex);
+            auto shared = sharedKeys[index].find(name);
+            if (shared != sharedKeys[index].end()) { key = shared->second; }
+        }
+        if (key == 0) {
+            key = sink.insertKey(worker, dictionary, name);
+            R3_LOG_DEBUG("Worker '{}' added {} '{}' with key '{}'.", worker, NAMES[index], name, key);
+            std::lock_guard<std::mutex> lock(sharedMutex);
+            sharedKeys[index].emplace(name, key);
+        }
+        keys.emplace(name, key);
+        return key;
+    }
+
+    void initialize(size_t workers) {
+        workerKeys.assign(workers, Dictionaries());
+        enabled = true;
+        log::logger->info("Writing events with dictionary keys for event types and players.");
+    }
+
+    void finalize() {
+        if (!enabled) { return; }
+        log::logger->info("Dictionary holds '{}' event types and '{}' players.",
+            sharedKeys[static_cast<size_t>(sink::Dictionary::EventType)].size(), sharedKeys[static_cast<size_t>(sink::Dictionary::Player)].size());
+        workerKeys.clear();
+        for (auto& keys : sharedKeys) {
+            keys.clear();
+        }
+        enabled = false;
+    }
+
+    bool isEnabled() {
+        return enabled;
+    }
+
+    void load(size_t worker, sink::Sink& sink) {
+        if (!enabled) { return; }
+        for (size_t index = 0; index < sharedKeys.size(); index++) {
+            Keys keys;
+            sink.loadKeys(worker, static_cast<sink::Dictionary>(index), keys);
+            {
+                std::lock_guard<std::mutex> lock(sharedMutex);
+                sharedKeys[index].insert(keys.begin(), keys.end());
+            }
+            R3_LOG_DEBUG("Worker '{}' loaded '{}' {} keys.", worker, keys.size(), NAMES[index]);
+            workerKeys[worker][index] = std::move(keys);
+        }
+    }
+
+    void encode(size_t worker, sink::Sink& sink, std::vector<sink::EventRow>& rows) {
+        if (!enabled) { return; }
+        for (auto& row : rows) {
+            row.typeKey = getKey(worker, sink, sink::Dictionary::EventType, row.type);
+            row.playerKey = getKey(worker, sink, sink::Dictionary::Player, row.playerId);
+        }
+    }
+
+} // namespace dictionary
+} // namespace r3
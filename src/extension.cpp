@@ -1,17 +1,33 @@
 #include "extension.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <fstream>
-#include <regex>
+#include <map>
+#include <set>
+#include <unordered_map>
 
 #ifdef _WIN32
 #include "shlobj.h"
 #endif
 
+#include "capture.h"
+#include "coalesce.h"
+#include "journal.h"
 #include "log.h"
+#include "remote.h"
+#include "ringbuffer.h"
+#include "sink.h"
+#include "staging.h"
+#include "stats.h"
+#include "tokenizer.h"
+#include "trace.h"
 
 #include "Poco/Environment.h"
 #include "Poco/Path.h"
 #include "Poco/File.h"
+#include "Poco/NumberParser.h"
 #include "Poco/StringTokenizer.h"
 #include "Poco/UnicodeConverter.h"
 #include "Poco/Util/PropertyFileConfiguration.h"
@@ -25,22 +41,511 @@ namespace {
     const std::string EXTENSION_FOLDER = "R3Extension";
     const std::string CONFIG_FILE = "config.properties";
     const std::string DEFAULT_REQUEST_PARAM_SEPARATOR = "`";
+    const uint32_t DEFAULT_BATCH_SIZE = 500;
+    const uint32_t DEFAULT_BATCH_LINGER = 100;
+    const uint32_t DEFAULT_QUEUE_CAPACITY = 65536;
+    const std::string DEFAULT_QUEUE_OVERFLOW = "newest";
+    const uint32_t DEFAULT_POOL_SIZE = 1;
+    const uint32_t DEFAULT_RECONNECT_MIN = 500;
+    const uint32_t DEFAULT_RECONNECT_MAX = 30000;
+    const uint32_t DEFAULT_REPLAY_ID_BLOCK = 0;
+    const std::string JOURNAL_FOLDER = "journal";
+    // The daemon keeps its own journal, the two processes must not share segments.
+    const std::string WRITER_JOURNAL_FOLDER = "writer_journal";
+    const std::string STAGING_FOLDER = "staging";
+    const std::string WRITER_STAGING_FOLDER = "writer_staging";
+    const uint32_t DEFAULT_LOAD_SIZE = 16;
+    const uint32_t DEFAULT_LOAD_INTERVAL = 5000;
+    const uint32_t DEFAULT_JOURNAL_THRESHOLD = 32768;
+    const uint32_t DEFAULT_JOURNAL_SEGMENT_SIZE = 16;
+    const std::chrono::milliseconds JOURNAL_DRAIN_INTERVAL(100);
+    // How long a push into a full queue waits before checking whether to give up.
+    const std::chrono::milliseconds PUSH_WAIT_INTERVAL(100);
+    const uint32_t DEFAULT_PLAYER_WINDOW = 0;
+    const std::chrono::milliseconds PLAYER_FLUSH_CHECK_INTERVAL(100);
+    const size_t REQUEST_POOL_SIZE = 4096;
+    const uint32_t DEFAULT_COALESCE_WINDOW = 0;
+    const uint32_t DEFAULT_WRITER_RING_SIZE = 64;
+    const std::chrono::milliseconds WRITER_HEARTBEAT_INTERVAL(100);
+    const std::chrono::milliseconds WRITER_POLL_INTERVAL(1);
+    const uint32_t DEFAULT_SHED_DEPTH = 0;
+    const uint32_t DEFAULT_SHED_LATENCY = 0;
+    const uint32_t DEFAULT_SHED_SAMPLE = 0;
+    const size_t PRIORITY_QUEUE_CAPACITY = 4096;
+    const std::string DEFAULT_SINK = "mysql";
+    const uint32_t DEFAULT_TRACE_SAMPLE = 0;
+    const uint32_t DEFAULT_TRACE_INTERVAL = 1000;
 
-    Queue<Request> requests;
-    std::thread sqlThread;
+    // Requests other than events are always high priority.
+    enum class Priority {
+        High,
+        Normal,
+        Low
+    };
+
+    // A player seen again with the same name within the window is only marked pending,
+    // pending players get one lastSeen update per window. Players not seen for a whole
+    // window are forgotten, so their next request is a full upsert again.
+    struct PlayerEntry {
+        std::string name;
+        bool pending;
+        uint64_t seen;
+    };
+
+    std::vector<std::unique_ptr<RingBuffer<Request>>> requests;
+    // Cleared requests handed back by the writers, taking one never allocates once the pool is warm.
+    std::unique_ptr<RingBuffer<Request>> requestPool;
+    remote::Side side = remote::Side::Extension;
+    // Set while requests go to the r3_writer daemon instead of the in-process writers.
+    std::atomic<bool> remoteWriting(false);
+    // Requests dropped because the writer ring was full, reported with the newest dropped by the queues.
+    std::atomic<uint64_t> remoteDropped(0);
+    // Served before the regular queue of the same writer, only used while the writers are behind.
+    std::vector<std::unique_ptr<RingBuffer<Request>>> priorityRequests;
+    std::vector<std::string> highPriorityTypes;
+    std::vector<std::string> lowPriorityTypes;
+    size_t shedDepth;
+    uint64_t shedLatency;
+    uint32_t shedSample;
+    uint64_t lowPriorityEvents = 0;
+    std::vector<std::thread> sqlThreads;
+    std::thread journalThread;
+    std::atomic<bool> journalStopping(false);
+    std::thread playerThread;
+    std::atomic<bool> playerStopping(false);
+    uint64_t playerWindow;
+    std::mutex playersMutex;
+    std::unordered_map<std::string, PlayerEntry> players;
+    std::string playerKey;
+    uint64_t coalescedPlayers = 0;
+    size_t journalThreshold;
+    size_t journalDrainSize;
+    bool journalOnShutdown;
     std::string requestParamSeparator;
+    bool deferParsing = false;
+    std::vector<StringRef> tokens;
+    std::string argsBuffer;
+    std::vector<size_t> argOffsets;
+    std::vector<StringRef> argTokens;
+    // Tickets are answered by 'result', at most MAX_RESULTS of them are kept for SQF to poll.
+    const size_t MAX_RESULTS = 1024;
+    std::mutex resultsMutex;
+    std::map<uint32_t, Response> results;
+    uint32_t nextTicket = 1;
     std::string configError = "";
+    // Set while a sampled call runs, requests pushed by it carry the trace id to the writers.
+    thread_local uint32_t callTraceId = 0;
+    thread_local uint64_t callStart = 0;
+
+    // A response too large for the output buffer, handed out a page at a time by 'next'.
+    struct PagedResponse {
+        std::string message;
+        size_t offset;
+    };
+
+    const size_t MAX_PAGED_RESPONSES = 16;
+    std::map<uint32_t, PagedResponse> pagedResponses;
+    uint32_t nextPageHandle = 1;
 }
 
-    void respond(char* output, const std::string& type, const std::string& data) {
-        std::string message = fmt::format("[\"{}\",{}]", type, data);
-        message.copy(output, message.length());
-        output[message.length()] = '\0';
+    // Makes room by discarding the oldest answered ticket SQF never polled, or the oldest pending one if none is answered.
+    void addResult(uint32_t ticket) {
+        std::lock_guard<std::mutex> lock(resultsMutex);
+        if (results.size() >= MAX_RESULTS) {
+            auto discarded = std::find_if(results.begin(), results.end(), [](const std::pair<const uint32_t, Response>& result) { return result.second.type != RESPONSE_TYPE_PENDING; });
+            if (discarded == results.end()) {
+                discarded = results.begin();
+            }
+            log::logger->warn("Discarding result of ticket '{}' that was never polled.", discarded->first);
+            results.erase(discarded);
+        }
+        results[ticket] = Response{ RESPONSE_TYPE_PENDING, std::to_string(ticket) };
+    }
+
+    void write(char*& position, const char* data, size_t size) {
+        std::memcpy(position, data, size);
+        position += size;
     }
 
-    void split(const std::string &str, const std::string& separator, std::vector<std::string> &elems) {
-        std::regex separatorRegex(separator);
-        elems = { std::sregex_token_iterator(str.begin(), str.end(), separatorRegex, -1), std::sregex_token_iterator() };
+    // Writes the next page of a paged response as ["partial",[handle,"chunk"]], the last page has
+    // the type ok. Chunks are SQF strings, joined they are the original ["type",data] response.
+    bool respondPage(char* output, int outputSize, uint32_t handle) {
+        auto paged = pagedResponses.find(handle);
+        if (paged == pagedResponses.end()) { return false; }
+        const std::string& message = paged->second.message;
+        std::string separator = fmt::format("\",[{},\"", handle);
+        size_t overhead = 2 + RESPONSE_TYPE_PARTIAL.size() + separator.size() + 3;
+        size_t budget = static_cast<size_t>(outputSize) - std::min(static_cast<size_t>(outputSize), overhead);
+        size_t begin = paged->second.offset;
+        size_t end = begin;
+        for (size_t used = 0; end < message.size(); end++) {
+            used += message[end] == '"' ? 2 : 1;
+            if (used > budget) { break; }
+        }
+        // Never split a UTF-8 sequence between pages.
+        while (end < message.size() && end > begin && (static_cast<uint8_t>(message[end]) & 0xC0) == 0x80) { end--; }
+        if (end == begin) { return false; }
+
+        bool last = end == message.size();
+        const std::string& type = last ? RESPONSE_TYPE_OK : RESPONSE_TYPE_PARTIAL;
+        char* position = output;
+        write(position, "[\"", 2);
+        write(position, type.data(), type.size());
+        write(position, separator.data(), separator.size());
+        for (size_t i = begin; i < end; i++) {
+            if (message[i] == '"') { *position++ = '"'; }
+            *position++ = message[i];
+        }
+        write(position, "\"]]", 3);
+        *position = '\0';
+        if (last) {
+            pagedResponses.erase(paged);
+        }
+        else {
+            paged->second.offset = end;
+        }
+        return true;
+    }
+
+    // Writes ["type",data] straight into output. A response larger than outputSize is kept and paged.
+    void respond(char* output, int outputSize, const std::string& type, const std::string& data) {
+        size_t size = type.size() + data.size() + 5;
+        if (size > static_cast<size_t>(outputSize)) {
+            if (pagedResponses.size() >= MAX_PAGED_RESPONSES) {
+                log::logger->warn("Discarding paged response '{}' that was never fully read.", pagedResponses.begin()->first);
+                pagedResponses.erase(pagedResponses.begin());
+            }
+            uint32_t handle = nextPageHandle++;
+            pagedResponses[handle] = PagedResponse{ fmt::format("[\"{}\",{}]", type, data), 0 };
+            if (!respondPage(output, outputSize, handle)) {
+                log::logger->error("Output size '{}' is too small to page a response!", outputSize);
+                pagedResponses.erase(handle);
+                output[0] = '\0';
+            }
+            return;
+        }
+        char* position = output;
+        write(position, "[\"", 2);
+        write(position, type.data(), type.size());
+        write(position, "\",", 2);
+        write(position, data.data(), data.size());
+        write(position, "]", 1);
+        *position = '\0';
+    }
+
+    // SQF strings escape a double quote by doubling it.
+    std::string quote(const std::string& str) {
+        std::string quoted = "\"";
+        for (char c : str) {
+            quoted += c;
+            if (c == '"') { quoted += c; }
+        }
+        return quoted + "\"";
+    }
+
+    // Leading digits of str as a number, like strtoul without needing a terminated string.
+    uint64_t parseLeadingDigits(const StringRef& str) {
+        uint64_t value = 0;
+        for (size_t i = 0; i < str.size && str.data[i] >= '0' && str.data[i] <= '9'; i++) {
+            value = value * 10 + (str.data[i] - '0');
+        }
+        return value;
+    }
+
+    // FNV-1a
+    uint64_t hash(const StringRef& str) {
+        uint64_t value = 14695981039346656037ULL;
+        for (size_t i = 0; i < str.size; i++) {
+            value = (value ^ static_cast<uint8_t>(str.data[i])) * 1099511628211ULL;
+        }
+        return value;
+    }
+
+    // Events are partitioned by replay and players by id, so each keeps its order on a single worker.
+    // A replay inserted with a reserved id goes to the worker of its events and is written before them.
+    size_t getWorker(const Request& request) {
+        if (requests.size() == 1) { return 0; }
+        if (request.command == Command::Event && request.size() > 1) {
+            return parseLeadingDigits(request.param(1)) % requests.size();
+        }
+        if (request.command == Command::InsertReplay && request.size() > 5) {
+            return parseLeadingDigits(request.param(5)) % requests.size();
+        }
+        if (request.command == Command::Player && request.size() > 1) {
+            StringRef id = request.param(1);
+            id.size = tokenizer::find(id.data, id.size);
+            return hash(id) % requests.size();
+        }
+        return request.ticket % requests.size();
+    }
+
+    Request takeRequest(Command command) {
+        Request request;
+        requestPool->poll(request);
+        request.command = command;
+        request.add(commands::get(command).name);
+        return request;
+    }
+
+    // A recycled request is done with, so a journal record it was read from is consumed.
+    void recycleRequest(Request&& request) {
+        journal::acknowledge(request);
+        request.clear();
+        requestPool->push(std::move(request));
+    }
+
+    // Once anything is journaled new requests follow it there until the journal is drained, which keeps them in order.
+    bool shouldJournal(const Request& request, size_t worker) {
+        return journal::isEnabled() && request.ticket == 0 &&
+            (!journal::empty() || !sql::isAvailable() || requests[worker]->size() >= journalThreshold);
+    }
+
+    // The type of an event, also while its params are not split yet.
+    StringRef getEventType(const Request& request) {
+        if (request.size() > 3) { return request.param(3); }
+        if (request.size() != 2) { return StringRef(); }
+        StringRef rest = request.param(1);
+        for (int field = 0; field < 2; field++) {
+            size_t offset = tokenizer::find(rest.data, rest.size);
+            if (offset == rest.size) { return StringRef(); }
+            offset += requestParamSeparator.size();
+            rest = StringRef(rest.data + offset, rest.size - offset);
+        }
+        rest.size = tokenizer::find(rest.data, rest.size);
+        return rest;
+    }
+
+    bool containsType(const std::vector<std::string>& types, const StringRef& type) {
+        for (auto& candidate : types) {
+            if (candidate.size() == type.size && std::memcmp(candidate.data(), type.data, type.size) == 0) { return true; }
+        }
+        return false;
+    }
+
+    Priority getPriority(const Request& request) {
+        if (request.command != Command::Event) { return Priority::High; }
+        StringRef type = getEventType(request);
+        if (containsType(highPriorityTypes, type)) { return Priority::High; }
+        if (containsType(lowPriorityTypes, type)) { return Priority::Low; }
+        return Priority::Normal;
+    }
+
+    // Closes the spans of a sampled request that leaves the queue without being written.
+    void endTrace(const Request& request) {
+        if (request.traceId == 0) { return; }
+        uint64_t time = trace::now();
+        trace::end("queue", request.traceId, time);
+        trace::end("request", request.traceId, time);
+    }
+
+    // Only untracked events and players are evicted by DropOldest, a dropped ticket would never be answered.
+    bool evictRequest(Request& request) {
+        bool droppable = request.ticket == 0 &&
+            (request.command == Command::Player || (request.command == Command::Event && getPriority(request) != Priority::High));
+        if (droppable) {
+            endTrace(request);
+            recycleRequest(std::move(request));
+        }
+        return droppable;
+    }
+
+    // Spill hands requests that do not fit into the queue to the journal, tickets cannot be answered from there.
+    bool spillRequest(Request& request) {
+        if (request.ticket != 0 || !journal::append(request)) { return false; }
+        endTrace(request);
+        recycleRequest(std::move(request));
+        return true;
+    }
+
+    // A stale latency does not count once the queue is empty, the writers have caught up then.
+    bool isBehind(size_t worker) {
+        size_t depth = requests[worker]->size();
+        return (shedDepth > 0 && depth >= shedDepth) ||
+            (shedLatency > 0 && depth > 0 && stats::getRecentLatency() >= shedLatency);
+    }
+
+    // Keeps one in shedSample low priority events, none if it is 0.
+    bool shouldShed() {
+        return shedSample == 0 || lowPriorityEvents++ % shedSample != 0;
+    }
+
+    bool pushRequest(Request&& request) {
+        if (remoteWriting) {
+            bool pushed = remote::push(request);
+            if (!pushed) {
+                remoteDropped++;
+            }
+            recycleRequest(std::move(request));
+            return pushed;
+        }
+        size_t worker = getWorker(request);
+        request.enqueued = stats::now();
+        Priority priority = Priority::Normal;
+        if (isBehind(worker)) {
+            priority = getPriority(request);
+            if (priority == Priority::Low && shouldShed()) {
+                stats::countShed();
+                recycleRequest(std::move(request));
+                return true;
+            }
+        }
+        if (shouldJournal(request, worker) && journal::append(request)) {
+            recycleRequest(std::move(request));
+            return true;
+        }
+        // Spans only begin for requests that reach a queue, shed and journaled ones are not written by the writers.
+        if (callTraceId != 0) {
+            request.traceId = callTraceId;
+            trace::begin("request", callTraceId, callStart);
+            trace::begin("queue", callTraceId, trace::now());
+        }
+        // A writer sleeping on an empty regular queue would not notice the priority queue, there is nothing to overtake then anyway.
+        if (priority == Priority::High && requests[worker]->size() > 0 && priorityRequests[worker]->push(std::move(request))) {
+            stats::countPrioritized();
+            return true;
+        }
+        if (!requests[worker]->push(std::move(request))) {
+            endTrace(request);
+            recycleRequest(std::move(request));
+            return false;
+        }
+        return true;
+    }
+
+    bool isBelowJournalThreshold() {
+        for (auto& queue : requests) {
+            if (queue->size() >= journalThreshold / 2) { return false; }
+        }
+        return true;
+    }
+
+    void drainJournal() {
+        std::vector<Request> batch;
+        while (!journalStopping) {
+            if (journal::empty() || !sql::isAvailable() || !isBelowJournalThreshold()) {
+                std::this_thread::sleep_for(JOURNAL_DRAIN_INTERVAL);
+                continue;
+            }
+            journal::read(batch, journalDrainSize);
+            R3_LOG_DEBUG("Streaming '{}' journaled requests back to the database, '{}' left.", batch.size(), journal::size());
+            // Requests not queued when stopping keep their records for the next start.
+            for (auto& request : batch) {
+                size_t worker = getWorker(request);
+                request.enqueued = stats::now();
+                bool queued = false;
+                while (!journalStopping && !(queued = requests[worker]->pushWait(std::move(request), PUSH_WAIT_INTERVAL))) {}
+                if (!queued) {
+                    request.keepJournalRecords();
+                    recycleRequest(std::move(request));
+                }
+            }
+        }
+    }
+
+    // Returns false if the player was seen within the window and its update is left to flushPlayers.
+    bool shouldQueuePlayer(const std::vector<StringRef>& tokens) {
+        if (playerWindow == 0 || tokens.size() != 3) { return true; }
+        std::lock_guard<std::mutex> lock(playersMutex);
+        playerKey.assign(tokens[1].data, tokens[1].size);
+        auto player = players.find(playerKey);
+        if (player == players.end() || player->second.name.size() != tokens[2].size ||
+            player->second.name.compare(0, std::string::npos, tokens[2].data, tokens[2].size) != 0) {
+            players[playerKey] = PlayerEntry{ tokens[2].str(), false, stats::now() };
+            return true;
+        }
+        player->second.pending = true;
+        player->second.seen = stats::now();
+        coalescedPlayers++;
+        return false;
+    }
+
+    void flushPlayers() {
+        Request request = takeRequest(Command::TouchPlayers);
+        uint64_t current = stats::now();
+        {
+            std::lock_guard<std::mutex> lock(playersMutex);
+            for (auto player = players.begin(); player != players.end();) {
+                if (player->second.pending) {
+                    request.add(player->first);
+                    player->second.pending = false;
+                }
+                else if (current - player->second.seen > playerWindow) {
+                    player = players.erase(player);
+                    continue;
+                }
+                ++player;
+            }
+        }
+        if (request.size() > 1) {
+            R3_LOG_DEBUG("Updating lastSeen of '{}' coalesced players.", request.size() - 1);
+            pushRequest(std::move(request));
+        }
+    }
+
+    void runPlayerFlush() {
+        uint64_t lastFlush = stats::now();
+        while (!playerStopping) {
+            std::this_thread::sleep_for(PLAYER_FLUSH_CHECK_INTERVAL);
+            if (stats::now() - lastFlush >= playerWindow) {
+                flushPlayers();
+                lastFlush = stats::now();
+            }
+        }
+    }
+
+    // A ticket cannot be answered after a restart, so ticketed requests fail instead of being journaled.
+    // A request read from the journal that cannot be journaled again keeps its record for the next start,
+    // other requests that cannot be journaled are dropped. Counts the requests taken in taken.
+    size_t persistQueues(size_t& taken) {
+        size_t persisted = 0;
+        Request request;
+        for (size_t worker = 0; worker < requests.size(); worker++) {
+            while (priorityRequests[worker]->poll(request) || requests[worker]->poll(request)) {
+                if (request.command == Command::Poison) {
+                    recycleRequest(std::move(request));
+                    continue;
+                }
+                taken++;
+                endTrace(request);
+                if (request.ticket != 0) {
+                    setResult(request.ticket, Response{ RESPONSE_TYPE_ERROR, "\"Extension stopped before the request was written!\"" });
+                }
+                else if (journal::append(request)) {
+                    persisted++;
+                }
+                else {
+                    request.keepJournalRecords();
+                }
+                recycleRequest(std::move(request));
+            }
+        }
+        return persisted;
+    }
+
+    // Matches 'event', or 'player' when players are not coalesced, followed by a literal separator.
+    // Returns the offset of the first param or 0 if the call must be split here.
+    size_t peekDeferred(const char* function, size_t length, Command& command) {
+        static const Command DEFERRED[] = { Command::Event, Command::Player };
+        for (Command candidate : DEFERRED) {
+            if (candidate == Command::Player && playerWindow > 0) { continue; }
+            const char* name = commands::get(candidate).name;
+            size_t nameSize = std::strlen(name);
+            size_t offset = nameSize + requestParamSeparator.size();
+            if (length > offset && std::memcmp(function, name, nameSize) == 0 &&
+                std::memcmp(function + nameSize, requestParamSeparator.data(), requestParamSeparator.size()) == 0) {
+                command = candidate;
+                return offset;
+            }
+        }
+        return 0;
+    }
+
+    Request makeRequest(Command command, const std::vector<StringRef>& tokens) {
+        Request request = takeRequest(command);
+        for (size_t i = 1; i < tokens.size(); i++) {
+            request.add(tokens[i]);
+        }
+        return request;
     }
 
     std::string getExtensionFolder() {
@@ -92,7 +597,30 @@ namespace {
         }
     }
 
-    bool initialize() {
+    uint32_t getUIntProperty(Poco::AutoPtr<Poco::Util::PropertyFileConfiguration> config, const std::string& key, uint32_t defaultValue) {
+        if (!config->has(key)) {
+            return defaultValue;
+        }
+        return getUIntProperty(config, key);
+    }
+
+    std::vector<std::string> getListProperty(Poco::AutoPtr<Poco::Util::PropertyFileConfiguration> config, const std::string& key) {
+        Poco::StringTokenizer items(config->getString(key, ""), ",", Poco::StringTokenizer::TOK_IGNORE_EMPTY | Poco::StringTokenizer::TOK_TRIM);
+        return std::vector<std::string>(items.begin(), items.end());
+    }
+
+    // Log properties are read before the logger exists, a value that is not a number is reported once it does.
+    uint32_t getLogProperty(Poco::AutoPtr<Poco::Util::PropertyFileConfiguration> config, const std::string& key, uint32_t defaultValue, std::vector<std::string>& invalidKeys) {
+        try {
+            return config->getUInt(key, defaultValue);
+        } catch (Poco::SyntaxException& e) {
+            invalidKeys.push_back(key);
+            return defaultValue;
+        }
+    }
+
+    bool initialize(remote::Side side_) {
+        side = side_;
         std::string extensionFolder(getExtensionFolder());
         std::string configFilePath(fmt::format("{}{}{}", extensionFolder, Poco::Path::separator(), CONFIG_FILE));
         Poco::File file(configFilePath);
@@ -106,86 +634,522 @@ namespace {
         Poco::AutoPtr<Poco::Util::PropertyFileConfiguration> config(new Poco::Util::PropertyFileConfiguration(configFilePath));
 
         std::string logLevel = config->getString("r3.log.level", "info");
-        log::initialze(extensionFolder, logLevel);
+        std::string logFlushLevel = config->getString("r3.log.flush.level", log::DEFAULT_FLUSH_LEVEL);
+        std::vector<std::string> invalidLogKeys;
+        uint32_t logQueueSize = getLogProperty(config, "r3.log.queue.size", log::DEFAULT_QUEUE_SIZE, invalidLogKeys);
+        uint32_t logFlushInterval = getLogProperty(config, "r3.log.flush.interval", log::DEFAULT_FLUSH_INTERVAL.count(), invalidLogKeys);
+        log::initialze(extensionFolder, logLevel, logFlushLevel, logQueueSize, std::chrono::milliseconds(logFlushInterval));
+        for (auto& key : invalidLogKeys) {
+            log::logger->warn("Property '{}' value '{}' is not a number, using the default.", key, config->getString(key));
+        }
+
+        if (side == remote::Side::Extension && config->getBool("r3.capture.enabled", false)) {
+            capture::initialize(extensionFolder);
+        }
+        if (side == remote::Side::Extension && trace::initialize(extensionFolder, getUIntProperty(config, "r3.trace.sample", DEFAULT_TRACE_SAMPLE),
+            std::chrono::milliseconds(getUIntProperty(config, "r3.trace.interval", DEFAULT_TRACE_INTERVAL)))) {
+            trace::setThreadName("game");
+        }
 
         requestParamSeparator = config->getString("r3.sqf.separator", DEFAULT_REQUEST_PARAM_SEPARATOR);
+        tokenizer::compile(requestParamSeparator);
+        R3_LOG_DEBUG("Using {} request param separator '{}'.", tokenizer::isLiteral() ? "literal" : "regex", requestParamSeparator);
+        deferParsing = config->getBool("r3.sqf.deferred", false);
+        if (deferParsing && !tokenizer::isLiteral()) {
+            deferParsing = false;
+            log::logger->warn("Deferred parsing needs a separator without regex special characters, parsing on the game thread.");
+        }
 
-        std::string host = getStringProperty(config, "r3.db.host");
-        uint32_t port = getUIntProperty(config, "r3.db.port");
-        std::string database = getStringProperty(config, "r3.db.database");
-        std::string user = getStringProperty(config, "r3.db.username");
-        std::string password = getStringProperty(config, "r3.db.password");
-        size_t timeout = getUIntProperty(config, "r3.db.timeout");
-        sql::initialize(host, port, database, user, password, timeout);
+        std::unique_ptr<sink::Sink> sink;
+        std::string sinkType = config->getString("r3.db.sink", DEFAULT_SINK);
+        if (sinkType == "memory" || sinkType == "null") {
+            log::logger->warn("Using the {} sink, rows are not written to the database!", sinkType);
+            sink.reset(new sink::MemorySink(sinkType == "memory"));
+        }
+        else {
+            if (sinkType != DEFAULT_SINK) {
+                log::logger->warn("Unknown sink '{}', using '{}'.", sinkType, DEFAULT_SINK);
+            }
+            std::string host = getStringProperty(config, "r3.db.host");
+            uint32_t port = getUIntProperty(config, "r3.db.port");
+            std::string database = getStringProperty(config, "r3.db.database");
+            std::string user = getStringProperty(config, "r3.db.username");
+            std::string password = getStringProperty(config, "r3.db.password");
+            size_t timeout = getUIntProperty(config, "r3.db.timeout");
+            sink = sink::createMySQL(host, port, database, user, password, timeout);
+        }
+        size_t batchSize = getUIntProperty(config, "r3.db.batch.size", DEFAULT_BATCH_SIZE);
+        size_t batchLinger = getUIntProperty(config, "r3.db.batch.linger", DEFAULT_BATCH_LINGER);
+        size_t poolSize = getUIntProperty(config, "r3.db.pool.size", DEFAULT_POOL_SIZE);
+        size_t reconnectMin = getUIntProperty(config, "r3.db.reconnect.min", DEFAULT_RECONNECT_MIN);
+        size_t reconnectMax = getUIntProperty(config, "r3.db.reconnect.max", DEFAULT_RECONNECT_MAX);
+        size_t replayIdBlock = getUIntProperty(config, "r3.db.replay.ids", DEFAULT_REPLAY_ID_BLOCK);
+        playerWindow = static_cast<uint64_t>(getUIntProperty(config, "r3.db.player.window", DEFAULT_PLAYER_WINDOW)) * 1000000;
+        bool dictionary = config->getBool("r3.db.dictionary", false);
+        sql::initialize(std::move(sink), batchSize, batchLinger, poolSize, reconnectMin, reconnectMax, replayIdBlock, dictionary);
+        size_t coalesceWindow = getUIntProperty(config, "r3.coalesce.window", DEFAULT_COALESCE_WINDOW);
+        coalesce::initialize(sql::getPoolSize(), std::chrono::milliseconds(coalesceWindow), getListProperty(config, "r3.coalesce.latest"), getListProperty(config, "r3.coalesce.merge"));
+        for (auto& name : getListProperty(config, "r3.db.load")) {
+            if (commands::find(StringRef(name.data(), name.size())) != Command::Event) {
+                log::logger->warn("Only events can be bulk loaded, '{}' rows are inserted.", name);
+                continue;
+            }
+            // Staging files hold the event type and player id as text, keys are only set by the writers.
+            if (dictionary) {
+                log::logger->warn("Events are not bulk loaded while 'r3.db.dictionary' is set, they are inserted.");
+                continue;
+            }
+            size_t loadSize = getUIntProperty(config, "r3.db.load.size", DEFAULT_LOAD_SIZE);
+            size_t loadInterval = getUIntProperty(config, "r3.db.load.interval", DEFAULT_LOAD_INTERVAL);
+            const std::string& stagingFolder = side == remote::Side::Writer ? WRITER_STAGING_FOLDER : STAGING_FOLDER;
+            staging::initialize(fmt::format("{}{}{}", extensionFolder, Poco::Path::separator(), stagingFolder), sql::getPoolSize(), loadSize * 1024 * 1024, std::chrono::milliseconds(loadInterval));
+        }
+
+        if (config->getBool("r3.journal.enabled", false)) {
+            journalThreshold = getUIntProperty(config, "r3.journal.threshold", DEFAULT_JOURNAL_THRESHOLD);
+            journalDrainSize = batchSize;
+            journalOnShutdown = config->getBool("r3.journal.shutdown", true);
+            size_t segmentSize = getUIntProperty(config, "r3.journal.segment.size", DEFAULT_JOURNAL_SEGMENT_SIZE);
+            const std::string& journalFolder = side == remote::Side::Writer ? WRITER_JOURNAL_FOLDER : JOURNAL_FOLDER;
+            journal::initialize(fmt::format("{}{}{}", extensionFolder, Poco::Path::separator(), journalFolder), segmentSize * 1024 * 1024);
+        }
+
+        size_t queueCapacity = getUIntProperty(config, "r3.queue.capacity", DEFAULT_QUEUE_CAPACITY);
+        std::string queueOverflow = config->getString("r3.queue.overflow", DEFAULT_QUEUE_OVERFLOW);
+        OverflowPolicy overflowPolicy = parseOverflowPolicy(queueOverflow);
+        for (size_t worker = 0; worker < sql::getPoolSize(); worker++) {
+            requests.emplace_back(new RingBuffer<Request>(queueCapacity, overflowPolicy, evictRequest, spillRequest));
+        }
+        if (overflowPolicy == OverflowPolicy::Spill && !journal::isEnabled()) {
+            log::logger->warn("Queue overflow 'spill' needs 'r3.journal.enabled=true', requests that do not fit are dropped.");
+        }
+        requestPool.reset(new RingBuffer<Request>(REQUEST_POOL_SIZE, OverflowPolicy::DropNewest));
+        for (size_t worker = 0; worker < requests.size(); worker++) {
+            priorityRequests.emplace_back(new RingBuffer<Request>(PRIORITY_QUEUE_CAPACITY, OverflowPolicy::DropNewest));
+        }
+        highPriorityTypes = getListProperty(config, "r3.priority.high");
+        lowPriorityTypes = getListProperty(config, "r3.priority.low");
+        shedDepth = getUIntProperty(config, "r3.shed.depth", DEFAULT_SHED_DEPTH);
+        shedLatency = static_cast<uint64_t>(getUIntProperty(config, "r3.shed.latency", DEFAULT_SHED_LATENCY)) * 1000000;
+        shedSample = getUIntProperty(config, "r3.shed.sample", DEFAULT_SHED_SAMPLE);
+        R3_LOG_DEBUG("Using '{}' high and '{}' low priority event types.", highPriorityTypes.size(), lowPriorityTypes.size());
+        R3_LOG_DEBUG("Using '{}' request queues with capacity '{}' and overflow policy '{}'.", requests.size(), requests[0]->capacity(), queueOverflow);
+
+        if (config->getBool("r3.writer.enabled", false)) {
+            size_t ringSize = getUIntProperty(config, "r3.writer.ring.size", DEFAULT_WRITER_RING_SIZE);
+            remote::initialize(extensionFolder, ringSize * 1024 * 1024, side);
+        }
 
         log::logger->info("Starting r3_extension version '{}'.", R3_EXTENSION_VERSION);
         return true;
     }
 
     void finalize() {
-        if (sql::isConnected()) {
-            requests.push(Request{ REQUEST_COMMAND_POISON });
-            sqlThread.join();
+        if (playerThread.joinable()) {
+            playerStopping = true;
+            playerThread.join();
+            flushPlayers();
+            log::logger->info("Coalesced '{}' repeated player requests.", coalescedPlayers);
+        }
+        if (sql::isStarted()) {
+            journalStopping = true;
+            journalThread.join();
+            if (journal::isEnabled() && (journalOnShutdown || !sql::isAvailable())) {
+                size_t taken = 0;
+                log::logger->info("Journaled '{}' queued requests on shutdown.", persistQueues(taken));
+            }
+            sql::stop();
+            // A worker that stopped without a connection does not read its queue anymore, nor need the poison.
+            for (size_t worker = 0; worker < requests.size(); worker++) {
+                while (!requests[worker]->pushWait(Request(Command::Poison), PUSH_WAIT_INTERVAL) && sql::isRunning(worker)) {}
+            }
+            for (auto& thread : sqlThreads) {
+                thread.join();
+            }
+            size_t left = 0;
+            size_t persisted = persistQueues(left);
+            if (left > 0) {
+                log::logger->warn("Writers stopped with '{}' requests queued, journaled '{}' of them.", left, persisted);
+            }
             sql::finalize();
         }
+        coalesce::finalize();
+        staging::finalize();
+        trace::finalize();
+        remote::finalize();
+        journal::finalize();
+        capture::finalize();
+        for (size_t worker = 0; worker < requests.size(); worker++) {
+            log::logger->info("Request queue '{}' dropped '{}' newest and '{}' oldest requests, spilled '{}'.", worker, requests[worker]->droppedNewest(), requests[worker]->droppedOldest(), requests[worker]->spilled());
+        }
+        if (remoteDropped > 0) {
+            log::logger->info("Writer ring dropped '{}' requests.", remoteDropped.load());
+        }
+        if (shedDepth > 0 || shedLatency > 0) {
+            log::logger->info("Shed '{}' low priority events.", stats::getShed());
+        }
         log::logger->info("Stopped r3_extension version '{}'.", R3_EXTENSION_VERSION);
+        log::finalize();
     }
 
-    void call(char* output, int outputSize, const char* function) {
-        if (!configError.empty()) {
-            respond(output, RESPONSE_TYPE_ERROR, fmt::format("\"{}\"", configError));
+    // SQF passes RVExtensionArgs strings the way str formats them, in double quotes with inner quotes doubled.
+    void unquote(const char* arg, std::string& buffer) {
+        size_t length = std::strlen(arg);
+        if (length < 2 || arg[0] != '"' || arg[length - 1] != '"') {
+            buffer.append(arg, length);
             return;
         }
-        Request request{ "" };
-        split(std::string(function), requestParamSeparator, request.params);
-        if (!request.params.empty()) {
-            request.command = request.params[0];
+        for (size_t i = 1; i < length - 1; i++) {
+            buffer += arg[i];
+            if (arg[i] == '"' && i + 2 < length && arg[i + 1] == '"') { i++; }
+        }
+    }
+
+    // Args become tokens directly, param 0 is the function name like with a split call string.
+    void makeArgTokens(const char* function, const char** argv, int argc) {
+        size_t total = 0;
+        for (int i = 0; i < argc; i++) {
+            total += std::strlen(argv[i]);
+        }
+        argsBuffer.clear();
+        argsBuffer.reserve(total);
+        argOffsets.assign(1, 0);
+        for (int i = 0; i < argc; i++) {
+            unquote(argv[i], argsBuffer);
+            argOffsets.push_back(argsBuffer.size());
+        }
+        argTokens.clear();
+        argTokens.emplace_back(function, std::strlen(function));
+        for (int i = 0; i < argc; i++) {
+            argTokens.emplace_back(argsBuffer.data() + argOffsets[i], argOffsets[i + 1] - argOffsets[i]);
+        }
+    }
+
+    // The workers connect in the background, requests are queued until they are connected.
+    void startWriters() {
+        sql::start();
+        for (size_t worker = 0; worker < requests.size(); worker++) {
+            sqlThreads.emplace_back(sql::run, worker);
+        }
+        journalThread = std::thread(drainJournal);
+    }
+
+    bool isConnected() {
+        return remoteWriting || sql::isStarted();
+    }
+
+    // Once the daemon's heartbeat is lost requests are written in process. The extension takes the ring
+    // over, so a daemon that was only stalled stops reading it, and takes back the requests still in it.
+    // Tickets the daemon took but never answered fail, they cannot be answered anymore.
+    void fallBackFromWriter() {
+        if (!remoteWriting || remote::isWriterAlive() || !remote::takeOver()) { return; }
+        log::logger->warn("Lost the r3_writer heartbeat, writing in process from now on.");
+        remoteWriting = false;
+        startWriters();
+        uint32_t ticket = 0;
+        Response response;
+        while (remote::popResult(ticket, response)) {
+            setResult(ticket, response);
+        }
+        std::vector<Request> stranded;
+        std::set<uint32_t> strandedTickets;
+        Request request;
+        while (remote::pop(request)) {
+            if (request.ticket != 0) {
+                strandedTickets.insert(request.ticket);
+            }
+            stranded.push_back(std::move(request));
+        }
+        size_t failed = 0;
+        {
+            std::lock_guard<std::mutex> lock(resultsMutex);
+            for (auto& result : results) {
+                if (result.second.type == RESPONSE_TYPE_PENDING && strandedTickets.count(result.first) == 0) {
+                    result.second = Response{ RESPONSE_TYPE_ERROR, "\"r3_writer stopped before answering!\"" };
+                    failed++;
+                }
+            }
         }
-        if (request.command == "version") {
-            respond(output, RESPONSE_TYPE_OK, fmt::format("\"{}\"", R3_EXTENSION_VERSION));
+        for (auto& strandedRequest : stranded) {
+            pushRequest(std::move(strandedRequest));
+        }
+        log::logger->info("Took back '{}' requests from the writer ring, failed '{}' unanswered tickets.", stranded.size(), failed);
+    }
+
+    std::string getState() {
+        if (!remoteWriting) { return sql::getState(); }
+        std::string state;
+        size_t connectedWorkers = 0, poolSize = 0;
+        remote::getWriterStatus(state, connectedWorkers, poolSize);
+        return state;
+    }
+
+    void dispatch(char* output, int outputSize, const std::vector<StringRef>& tokens) {
+        Command command = tokens.empty() ? Command::Unknown : commands::find(tokens[0]);
+        const commands::Definition& definition = commands::get(command);
+        if (definition.handling == commands::Handling::Internal) {
+            respond(output, outputSize, RESPONSE_TYPE_ERROR, "\"Unkown command\"");
             return;
         }
-        else if (request.command == "separator") {
-            respond(output, RESPONSE_TYPE_OK, fmt::format("\"{}\"", requestParamSeparator));
+        if (definition.handling != commands::Handling::Sync && !isConnected()) {
+            respond(output, outputSize, RESPONSE_TYPE_ERROR, "\"Not connected to the database!\"");
             return;
         }
-        else if (request.command == "connect") {
-            if (sql::isConnected()) {
-                respond(output, RESPONSE_TYPE_OK, "true");
+        fallBackFromWriter();
+        switch (command) {
+        case Command::Version:
+            respond(output, outputSize, RESPONSE_TYPE_OK, fmt::format("\"{}\"", R3_EXTENSION_VERSION));
+            return;
+        case Command::Separator:
+            respond(output, outputSize, RESPONSE_TYPE_OK, fmt::format("\"{}\"", requestParamSeparator));
+            return;
+        case Command::Stats: {
+            size_t depth = 0, highWater = 0;
+            uint64_t dropped = remoteDropped;
+            for (auto& queue : requests) {
+                depth += queue->size();
+                highWater = std::max(highWater, queue->highWaterMark());
+                dropped += queue->droppedNewest() + queue->droppedOldest();
+            }
+            for (auto& queue : priorityRequests) {
+                depth += queue->size();
+            }
+            respond(output, outputSize, RESPONSE_TYPE_OK, stats::format(depth, highWater, journal::size(), dropped));
+            return;
+        }
+        case Command::Queue: {
+            std::string depths;
+            uint64_t droppedNewest = remoteDropped, droppedOldest = 0, spilled = 0;
+            for (auto& queue : requests) {
+                depths += fmt::format("{}{}", depths.empty() ? "" : ",", queue->size());
+                droppedNewest += queue->droppedNewest();
+                droppedOldest += queue->droppedOldest();
+                spilled += queue->spilled();
+            }
+            respond(output, outputSize, RESPONSE_TYPE_OK, fmt::format("[[{}],{},{},{},{}]", depths, requests[0]->capacity(), droppedNewest, droppedOldest, spilled));
+            return;
+        }
+        case Command::Connect:
+            if (!isConnected()) {
+                if (remote::isWriterAlive()) {
+                    log::logger->info("Handing requests to the r3_writer daemon.");
+                    remoteWriting = true;
+                }
+                else {
+                    startWriters();
+                }
+                if (playerWindow > 0) {
+                    playerThread = std::thread(runPlayerFlush);
+                }
+            }
+            respond(output, outputSize, RESPONSE_TYPE_OK, quote(getState()));
+            return;
+        case Command::Status:
+            if (remoteWriting) {
+                std::string state;
+                size_t connectedWorkers = 0, poolSize = 0;
+                remote::getWriterStatus(state, connectedWorkers, poolSize);
+                respond(output, outputSize, RESPONSE_TYPE_OK, fmt::format("[{},{},{},{}]", quote(state), connectedWorkers, poolSize, EMPTY_SQF_DATA));
                 return;
             }
-            std::string message = sql::connect();
-            if (message.empty()) {
-                sqlThread = std::thread(sql::run);
-                respond(output, RESPONSE_TYPE_OK, "true");
+            respond(output, outputSize, RESPONSE_TYPE_OK, fmt::format("[{},{},{},{}]", quote(sql::getState()), sql::getConnectedWorkers(), sql::getPoolSize(), quote(sql::getLastError())));
+            return;
+        case Command::Replay: {
+            stats::countRequest(stats::COMMAND_REPLAY);
+            uint32_t replayId = 0;
+            if (tokens.size() == definition.paramCount + 1u && sql::takeReplayId(replayId)) {
+                Request request = makeRequest(Command::InsertReplay, tokens);
+                request.add(std::to_string(replayId));
+                if (!pushRequest(std::move(request))) {
+                    respond(output, outputSize, RESPONSE_TYPE_ERROR, "\"Request queue is full!\"");
+                    return;
+                }
+                respond(output, outputSize, RESPONSE_TYPE_OK, std::to_string(replayId));
                 return;
             }
-            respond(output, RESPONSE_TYPE_ERROR, message);
+            uint32_t ticket = nextTicket++;
+            addResult(ticket);
+            Request request = makeRequest(Command::Replay, tokens);
+            request.ticket = ticket;
+            if (!pushRequest(std::move(request))) {
+                setResult(ticket, Response{ RESPONSE_TYPE_ERROR, "\"Request queue is full!\"" });
+            }
+            respond(output, outputSize, RESPONSE_TYPE_PENDING, std::to_string(ticket));
             return;
         }
-        else if (!sql::isConnected()) {
-            respond(output, RESPONSE_TYPE_ERROR, "\"Not connected to the database!\"");
+        case Command::Next: {
+            uint32_t handle = 0;
+            if (tokens.size() < 2 || !Poco::NumberParser::tryParseUnsigned(tokens[1].str(), handle) || !respondPage(output, outputSize, handle)) {
+                respond(output, outputSize, RESPONSE_TYPE_ERROR, "\"Unknown page handle!\"");
+            }
             return;
         }
-        else if (request.command == "replay") {
+        case Command::Result: {
+            uint32_t ticket = 0;
+            if (tokens.size() < 2 || !Poco::NumberParser::tryParseUnsigned(tokens[1].str(), ticket)) {
+                respond(output, outputSize, RESPONSE_TYPE_ERROR, "\"Missing ticket!\"");
+                return;
+            }
+            uint32_t remoteTicket = 0;
             Response response;
+            while (remote::popResult(remoteTicket, response)) {
+                setResult(remoteTicket, response);
+            }
             {
-                std::lock_guard<std::mutex> lock(sql::getSessionMutex());
-                response = sql::processRequest(request);
+                std::lock_guard<std::mutex> lock(resultsMutex);
+                auto result = results.find(ticket);
+                if (result == results.end()) {
+                    response = Response{ RESPONSE_TYPE_ERROR, "\"Unknown ticket!\"" };
+                }
+                else {
+                    response = result->second;
+                    if (response.type != RESPONSE_TYPE_PENDING) {
+                        results.erase(result);
+                    }
+                }
+            }
+            respond(output, outputSize, response.type, response.data);
+            return;
+        }
+        case Command::Player:
+        case Command::Event:
+            stats::countRequest(command == Command::Event ? stats::COMMAND_EVENT : stats::COMMAND_PLAYER);
+            if (command == Command::Event || shouldQueuePlayer(tokens)) {
+                pushRequest(makeRequest(command, tokens));
+            }
+            respond(output, outputSize, RESPONSE_TYPE_OK, EMPTY_SQF_DATA);
+            return;
+        default:
+            respond(output, outputSize, RESPONSE_TYPE_ERROR, "\"Unkown command\"");
+        }
+    }
+
+    void dispatch(char* output, int outputSize, const char* function) {
+        if (!configError.empty()) {
+            respond(output, outputSize, RESPONSE_TYPE_ERROR, fmt::format("\"{}\"", configError));
+            return;
+        }
+        size_t length = std::strlen(function);
+        fallBackFromWriter();
+        // Deferred requests are copied as they are, the writer splits them.
+        Command deferred = Command::Unknown;
+        size_t offset = deferParsing && isConnected() ? peekDeferred(function, length, deferred) : 0;
+        if (offset > 0) {
+            stats::countRequest(deferred == Command::Event ? stats::COMMAND_EVENT : stats::COMMAND_PLAYER);
+            Request request = takeRequest(deferred);
+            request.add(function + offset, length - offset);
+            pushRequest(std::move(request));
+            respond(output, outputSize, RESPONSE_TYPE_OK, EMPTY_SQF_DATA);
+            return;
+        }
+        tokenizer::split(function, length, tokens);
+        dispatch(output, outputSize, tokens);
+    }
+
+    void beginCall() {
+        callTraceId = trace::isEnabled() ? trace::sample() : 0;
+        if (callTraceId != 0) {
+            callStart = trace::now();
+        }
+    }
+
+    void endCall() {
+        if (callTraceId != 0) {
+            trace::complete("call", callTraceId, callStart, trace::now());
+            callTraceId = 0;
+        }
+    }
+
+    void call(char* output, int outputSize, const char* function) {
+        uint64_t start = stats::now();
+        if (capture::isEnabled()) {
+            capture::record(function, std::strlen(function));
+        }
+        beginCall();
+        dispatch(output, outputSize, function);
+        endCall();
+        stats::recordCallTime(stats::now() - start);
+    }
+
+    int callArgs(char* output, int outputSize, const char* function, const char** argv, int argc) {
+        uint64_t start = stats::now();
+        if (!configError.empty()) {
+            respond(output, outputSize, RESPONSE_TYPE_ERROR, fmt::format("\"{}\"", configError));
+            return 0;
+        }
+        makeArgTokens(function, argv, argc);
+        // Captured as the equivalent call string, so traces replay through call().
+        if (capture::isEnabled()) {
+            std::string joined;
+            for (auto& token : argTokens) {
+                if (!joined.empty()) { joined += requestParamSeparator; }
+                joined.append(token.data, token.size);
+            }
+            capture::record(joined.data(), joined.size());
+        }
+        beginCall();
+        dispatch(output, outputSize, argTokens);
+        endCall();
+        stats::recordCallTime(stats::now() - start);
+        return 0;
+    }
+
+    void runWriter(const std::atomic<bool>& stopping) {
+        if (!remote::isEnabled()) {
+            log::logger->error("r3_writer needs 'r3.writer.enabled=true' in the config file.");
+            return;
+        }
+        // Players are already coalesced by the extension.
+        startWriters();
+        auto nextHeartbeat = std::chrono::steady_clock::now();
+        // Reused while the ring is empty, a pooled one is only taken once it was handed on.
+        Request request;
+        requestPool->poll(request);
+        while (!stopping) {
+            if (!remote::isOwner()) {
+                log::logger->error("The extension took over the writer ring after missing heartbeats, stopping r3_writer.");
+                return;
+            }
+            auto now = std::chrono::steady_clock::now();
+            if (now >= nextHeartbeat) {
+                remote::heartbeat(sql::getState(), sql::getConnectedWorkers(), sql::getPoolSize());
+                nextHeartbeat = now + WRITER_HEARTBEAT_INTERVAL;
+            }
+            if (!remote::pop(request)) {
+                std::this_thread::sleep_for(WRITER_POLL_INTERVAL);
+                continue;
+            }
+            pushRequest(std::move(request));
+            requestPool->poll(request);
+        }
+    }
+
+    bool popRequest(size_t worker, Request& request, const std::chrono::milliseconds& timeout) {
+        if (priorityRequests[worker]->poll(request)) { return true; }
+        return requests[worker]->pop(request, timeout);
+    }
+
+    void setResult(uint32_t ticket, const Response& response) {
+        if (side == remote::Side::Writer && remote::isEnabled()) {
+            if (!remote::pushResult(ticket, response)) {
+                log::logger->error("Writer ring is full, dropping the result of ticket '{}'!", ticket);
             }
-            respond(output, RESPONSE_TYPE_OK, response.data);
             return;
         }
-        else if (request.command == "player" || request.command == "event") {
-            requests.push(request);
-            respond(output, RESPONSE_TYPE_OK, EMPTY_SQF_DATA);
+        std::lock_guard<std::mutex> lock(resultsMutex);
+        auto result = results.find(ticket);
+        if (result == results.end()) {
+            R3_LOG_DEBUG("Dropping the result of discarded ticket '{}'.", ticket);
             return;
         }
-        respond(output, RESPONSE_TYPE_ERROR, "\"Unkown command\"");
+        result->second = response;
     }
 
-    Request popRequest() {
-        return requests.pop();
+    void recycle(std::vector<Request>& batch) {
+        for (auto& request : batch) {
+            recycleRequest(std::move(request));
+        }
+        batch.clear();
     }
 
 } // namespace extension
@@ -0,0 +1,361 @@
+#include "journal.h"
+
+#include "extension.h"
+#include "log.h"
+
+#include "Poco/Exception.h"
+#include "Poco/File.h"
+#include "Poco/NumberParser.h"
+#include "Poco/Path.h"
+#include "Poco/SharedMemory.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+
+
+namespace r3 {
+namespace journal {
+
+namespace {
+    const std::string SEGMENT_PREFIX = "journal_";
+    const std::string SEGMENT_EXTENSION = ".r3j";
+    const size_t MIN_SEGMENT_SIZE = 64 * 1024;
+    // Offsets in a segment must fit into the low half of a record id.
+    const size_t MAX_SEGMENT_SIZE = UINT32_MAX;
+
+    // A segment is a preallocated, zero filled file mapped into memory. Records are
+    // appended as [uint32 length][uint16 param count]([uint32 size][bytes])*, the
+    // length is written last so a record torn by a crash reads as the end of the segment.
+    // A record read back gets CONSUMED_FLAG in its length once its request is acknowledged,
+    // so a restart skips it. Records read but not acknowledged are read again after a restart.
+    struct Segment {
+        uint64_t sequence;
+        std::unique_ptr<Poco::SharedMemory> memory;
+        size_t offset;
+    };
+
+    const uint64_t NO_SEGMENT = UINT64_MAX;
+    const uint32_t CONSUMED_FLAG = 0x80000000;
+
+    std::string folder;
+    size_t segmentSize;
+    bool enabled = false;
+    std::mutex journalMutex;
+    std::deque<uint64_t> segments;
+    uint64_t nextSequence = 0;
+    Segment writer;
+    Segment reader;
+    // Maps the segment records are acknowledged in when it is neither the writer's nor the reader's.
+    Segment acknowledger;
+    // Records read but not acknowledged yet per segment, a segment is removed once it is read and has none.
+    std::map<uint64_t, size_t> outstanding;
+    std::string record;
+    std::atomic<uint64_t> pending(0);
+}
+
+    std::string getSegmentPath(uint64_t sequence) {
+        return fmt::format("{}{}{}{:010}{}", folder, Poco::Path::separator(), SEGMENT_PREFIX, sequence, SEGMENT_EXTENSION);
+    }
+
+    // Record ids are never 0, which marks a request that was not read from the journal.
+    uint64_t getRecordId(uint64_t sequence, size_t offset) {
+        return ((sequence + 1) << 32) | offset;
+    }
+
+    size_t getCapacity(const Segment& segment) {
+        return segment.memory->end() - segment.memory->begin();
+    }
+
+    template <typename T>
+    void write(std::string& buffer, T value) {
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    bool read(const char*& position, const char* end, T& value) {
+        if (static_cast<size_t>(end - position) < sizeof(T)) { return false; }
+        std::memcpy(&value, position, sizeof(T));
+        position += sizeof(T);
+        return true;
+    }
+
+    void encode(const Request& request, std::string& buffer) {
+        buffer.clear();
+        write<uint32_t>(buffer, 0);
+        write<uint16_t>(buffer, static_cast<uint16_t>(request.size()));
+        for (size_t i = 0; i < request.size(); i++) {
+            StringRef param = request.param(i);
+            write<uint32_t>(buffer, static_cast<uint32_t>(param.size));
+            buffer.append(param.data, param.size);
+        }
+    }
+
+    bool decode(const char* position, const char* end, Request& request) {
+        uint16_t count = 0;
+        if (!read(position, end, count) || count == 0) { return false; }
+        request.clear();
+        for (uint16_t i = 0; i < count; i++) {
+            uint32_t size = 0;
+            if (!read(position, end, size) || static_cast<size_t>(end - position) < size) { return false; }
+            request.add(position, size);
+            position += size;
+        }
+        request.command = commands::find(request.param(0));
+        return true;
+    }
+
+    // Returns the size of the next complete record at offset, or 0 at the end of the written data.
+    uint32_t peekRecord(const char* begin, size_t offset, size_t limit, bool& consumed) {
+        uint32_t length = 0;
+        if (offset + sizeof(uint32_t) > limit) { return 0; }
+        std::memcpy(&length, begin + offset, sizeof(uint32_t));
+        consumed = (length & CONSUMED_FLAG) != 0;
+        length &= ~CONSUMED_FLAG;
+        if (length <= sizeof(uint32_t) || offset + length > limit) { return 0; }
+        return length;
+    }
+
+    uint64_t countRecords(uint64_t sequence) {
+        Poco::SharedMemory memory(Poco::File(getSegmentPath(sequence)), Poco::SharedMemory::AM_READ);
+        size_t limit = memory.end() - memory.begin();
+        size_t offset = 0;
+        uint64_t count = 0;
+        bool consumed = false;
+        while (uint32_t length = peekRecord(memory.begin(), offset, limit, consumed)) {
+            offset += length;
+            if (!consumed) { count++; }
+        }
+        return count;
+    }
+
+    void markConsumed(char* position) {
+        uint32_t length = 0;
+        std::memcpy(&length, position, sizeof(uint32_t));
+        length |= CONSUMED_FLAG;
+        std::memcpy(position, &length, sizeof(uint32_t));
+    }
+
+    // The writer's and the reader's mappings are reused, other segments are mapped on demand.
+    Poco::SharedMemory& getMemory(uint64_t sequence) {
+        if (writer.memory && writer.sequence == sequence) { return *writer.memory; }
+        if (reader.memory && reader.sequence == sequence) { return *reader.memory; }
+        if (!acknowledger.memory || acknowledger.sequence != sequence) {
+            acknowledger.memory.reset();
+            acknowledger.sequence = sequence;
+            acknowledger.memory.reset(new Poco::SharedMemory(Poco::File(getSegmentPath(sequence)), Poco::SharedMemory::AM_WRITE));
+        }
+        return *acknowledger.memory;
+    }
+
+    void removeSegment(uint64_t sequence) {
+        if (acknowledger.sequence == sequence) {
+            acknowledger.memory.reset();
+            acknowledger.sequence = NO_SEGMENT;
+        }
+        try {
+            Poco::File(getSegmentPath(sequence)).remove();
+        }
+        catch (Poco::Exception& e) {
+            log::logger->error("Failed to remove journal segment '{}'! Error message: {}", sequence, e.displayText());
+        }
+        R3_LOG_DEBUG("Journal segment '{}' fully read and acknowledged.", sequence);
+    }
+
+    void openWriter(size_t minSize) {
+        writer.sequence = nextSequence++;
+        Poco::File file(getSegmentPath(writer.sequence));
+        file.createFile();
+        file.setSize(std::max(segmentSize, minSize));
+        writer.memory.reset(new Poco::SharedMemory(file, Poco::SharedMemory::AM_WRITE));
+        writer.offset = 0;
+        segments.push_back(writer.sequence);
+        R3_LOG_DEBUG("Opened journal segment '{}'.", writer.sequence);
+    }
+
+    bool initialize(const std::string& folder_, size_t segmentSize_) {
+        folder = folder_;
+        segmentSize = std::min(std::max(segmentSize_, MIN_SEGMENT_SIZE), MAX_SEGMENT_SIZE);
+        reader.sequence = NO_SEGMENT;
+        acknowledger.sequence = NO_SEGMENT;
+        try {
+            Poco::File(folder).createDirectories();
+            std::vector<std::string> files;
+            Poco::File(folder).list(files);
+            for (auto& file : files) {
+                uint64_t sequence = 0;
+                if (file.size() <= SEGMENT_PREFIX.size() + SEGMENT_EXTENSION.size() ||
+                    file.compare(0, SEGMENT_PREFIX.size(), SEGMENT_PREFIX) != 0 ||
+                    file.compare(file.size() - SEGMENT_EXTENSION.size(), SEGMENT_EXTENSION.size(), SEGMENT_EXTENSION) != 0 ||
+                    !Poco::NumberParser::tryParseUnsigned64(file.substr(SEGMENT_PREFIX.size(), file.size() - SEGMENT_PREFIX.size() - SEGMENT_EXTENSION.size()), sequence)) {
+                    continue;
+                }
+                segments.push_back(sequence);
+            }
+            std::sort(segments.begin(), segments.end());
+            for (auto sequence : segments) {
+                pending += countRecords(sequence);
+            }
+            nextSequence = segments.empty() ? 0 : segments.back() + 1;
+        }
+        catch (Poco::Exception& e) {
+            log::logger->error("Failed to open journal in '{}'! Error message: {}", folder, e.displayText());
+            return false;
+        }
+        enabled = true;
+        log::logger->info("Journal in '{}' has '{}' pending requests in '{}' segments.", folder, pending, segments.size());
+        return true;
+    }
+
+    void finalize() {
+        std::lock_guard<std::mutex> lock(journalMutex);
+        writer.memory.reset();
+        reader.memory.reset();
+        acknowledger.memory.reset();
+        if (enabled) {
+            size_t unacknowledged = 0;
+            for (auto& segment : outstanding) {
+                unacknowledged += segment.second;
+            }
+            log::logger->info("Journal closed with '{}' pending and '{}' unacknowledged requests.", pending, unacknowledged);
+        }
+        enabled = false;
+        segments.clear();
+        outstanding.clear();
+        pending = 0;
+    }
+
+    bool isEnabled() {
+        return enabled;
+    }
+
+    bool empty() {
+        return pending == 0;
+    }
+
+    uint64_t size() {
+        return pending;
+    }
+
+    bool append(const Request& request) {
+        if (!enabled) { return false; }
+        std::lock_guard<std::mutex> lock(journalMutex);
+        encode(request, record);
+        uint32_t length = static_cast<uint32_t>(record.size());
+        try {
+            if (!writer.memory || writer.offset + length + sizeof(uint32_t) > getCapacity(writer)) {
+                writer.memory.reset();
+                openWriter(length + sizeof(uint32_t));
+            }
+            char* position = writer.memory->begin() + writer.offset;
+            std::memcpy(position + sizeof(uint32_t), record.data() + sizeof(uint32_t), length - sizeof(uint32_t));
+            std::memcpy(position, &length, sizeof(uint32_t));
+            writer.offset += length;
+        }
+        catch (Poco::Exception& e) {
+            log::logger->error("Failed to append '{}' request to journal! Error message: {}", commands::get(request.command).name, e.displayText());
+            return false;
+        }
+        pending++;
+        return true;
+    }
+
+    size_t read(std::vector<Request>& requests, size_t maxRequests) {
+        requests.clear();
+        std::lock_guard<std::mutex> lock(journalMutex);
+        while (requests.size() < maxRequests && !segments.empty()) {
+            uint64_t sequence = segments.front();
+            if (reader.sequence != sequence) {
+                reader.sequence = sequence;
+                reader.memory.reset();
+                reader.offset = 0;
+            }
+            bool isWriter = writer.memory && writer.sequence == sequence;
+            uint32_t length = 0;
+            bool consumed = false;
+            char* begin = nullptr;
+            try {
+                if (isWriter) {
+                    begin = writer.memory->begin();
+                    length = peekRecord(begin, reader.offset, writer.offset, consumed);
+                }
+                else {
+                    if (!reader.memory) {
+                        reader.memory.reset(new Poco::SharedMemory(Poco::File(getSegmentPath(sequence)), Poco::SharedMemory::AM_WRITE));
+                    }
+                    begin = reader.memory->begin();
+                    length = peekRecord(begin, reader.offset, getCapacity(reader), consumed);
+                }
+            }
+            catch (Poco::Exception& e) {
+                log::logger->error("Failed to read journal segment '{}'! Error message: {}", sequence, e.displayText());
+            }
+            if (length != 0) {
+                char* position = begin + reader.offset;
+                size_t offset = reader.offset;
+                reader.offset += length;
+                if (consumed) { continue; }
+                pending--;
+                requests.emplace_back();
+                if (!decode(position + sizeof(uint32_t), position + length, requests.back())) {
+                    log::logger->error("Dropping corrupt journal record in segment '{}' at offset '{}'!", sequence, offset);
+                    requests.pop_back();
+                    markConsumed(position);
+                    continue;
+                }
+                requests.back().journalRecord = getRecordId(sequence, offset);
+                outstanding[sequence]++;
+                continue;
+            }
+            // New records go to a new segment, this one is removed once all its records are acknowledged.
+            if (isWriter) {
+                writer.memory.reset();
+            }
+            reader.memory.reset();
+            R3_LOG_DEBUG("Journal segment '{}' fully read.", sequence);
+            segments.pop_front();
+            auto unacknowledged = outstanding.find(sequence);
+            if (unacknowledged == outstanding.end()) {
+                removeSegment(sequence);
+            }
+        }
+        return requests.size();
+    }
+
+    // Called with journalMutex held.
+    void acknowledgeRecord(uint64_t record) {
+        if (record == 0) { return; }
+        uint64_t sequence = (record >> 32) - 1;
+        size_t offset = static_cast<uint32_t>(record);
+        auto unacknowledged = outstanding.find(sequence);
+        if (!enabled || unacknowledged == outstanding.end()) { return; }
+        try {
+            markConsumed(getMemory(sequence).begin() + offset);
+        }
+        catch (Poco::Exception& e) {
+            log::logger->error("Failed to acknowledge journal record in segment '{}' at offset '{}'! Error message: {}", sequence, offset, e.displayText());
+        }
+        // Only the front segment can still be read from.
+        if (--unacknowledged->second == 0) {
+            outstanding.erase(unacknowledged);
+            if (segments.empty() || segments.front() != sequence) {
+                removeSegment(sequence);
+            }
+        }
+    }
+
+    void acknowledge(const Request& request) {
+        if (request.journalRecord == 0 && request.coalescedRecords.empty()) { return; }
+        std::lock_guard<std::mutex> lock(journalMutex);
+        acknowledgeRecord(request.journalRecord);
+        for (uint64_t record : request.coalescedRecords) {
+            acknowledgeRecord(record);
+        }
+    }
+
+} // namespace journal
+} // namespace r3
@@ -1,5 +1,7 @@
 #include "log.h"
 
+#include "util.h"
+
 #include "Poco/Path.h"
 #include "Poco/DateTimeFormatter.h"
 #include "Poco/LocalDateTime.h"
@@ -9,14 +11,34 @@ namespace log {
 
 namespace {
     const std::string LOGGER_NAME = "r3_extension_log";
+
+    // The level names of spdlog, and warn and error as the config file uses them.
+    const std::pair<const char*, spdlog::level::level_enum> LEVELS[] = {
+        { "trace", spdlog::level::trace },
+        { "debug", spdlog::level::debug },
+        { "info", spdlog::level::info },
+        { "notice", spdlog::level::notice },
+        { "warn", spdlog::level::warn },
+        { "warning", spdlog::level::warn },
+        { "error", spdlog::level::err },
+        { "critical", spdlog::level::critical },
+        { "alert", spdlog::level::alert },
+        { "emerg", spdlog::level::emerg },
+        { "off", spdlog::level::off }
+    };
 }
 
     std::shared_ptr<spdlog::logger> logger;
 
-    spdlog::level::level_enum getLogLevel(const std::string& logLevel) {
-        if (logLevel == "debug") { return spdlog::level::debug; }
-        if (logLevel == "trace") { return spdlog::level::trace; }
-        return spdlog::level::info;
+    // Leaves level as it is and returns false if the name is unknown.
+    bool getLogLevel(const std::string& name, spdlog::level::level_enum& level) {
+        for (auto& known : LEVELS) {
+            if (name == known.first) {
+                level = known.second;
+                return true;
+            }
+        }
+        return false;
     }
 
     std::string getLogFileName() {
@@ -25,14 +47,34 @@ namespace {
         return fileName;
     }
 
-    bool initialze(const std::string& extensionFolder, const std::string& logLevel) {
+    bool initialze(const std::string& extensionFolder, const std::string& logLevel, const std::string& flushLevel,
+        size_t queueSize, const std::chrono::milliseconds& flushInterval) {
+        // A full queue blocks the caller rather than losing errors, the queue only fills up if the disk cannot keep up.
+        // The async queue of spdlog needs a power of two size.
+        spdlog::set_async_mode(util::roundUpToPowerOfTwo(queueSize), spdlog::async_overflow_policy::block_retry, nullptr, flushInterval);
         logger = spdlog::rotating_logger_mt(LOGGER_NAME, fmt::format("{}{}{}", extensionFolder, Poco::Path::separator(), getLogFileName()), 1024 * 1024 * 20, 1);
-        logger->flush_on(spdlog::level::trace);
-        logger->set_level(getLogLevel(logLevel));
+        spdlog::level::level_enum level = spdlog::level::info;
+        spdlog::level::level_enum flushOn = spdlog::level::warn;
+        getLogLevel(DEFAULT_FLUSH_LEVEL, flushOn);
+        bool knownLevel = getLogLevel(logLevel, level);
+        bool knownFlushLevel = getLogLevel(flushLevel, flushOn);
+        logger->flush_on(flushOn);
+        logger->set_level(level);
+        if (!knownLevel) {
+            logger->warn("Unknown log level '{}', using 'info'.", logLevel);
+        }
+        if (!knownFlushLevel) {
+            logger->warn("Unknown log flush level '{}', using '{}'.", flushLevel, DEFAULT_FLUSH_LEVEL);
+        }
         return true;
     }
 
+    // Dropping the last reference stops the background thread after it has written the queued messages.
     void finalize() {
+        if (!logger) { return; }
+        logger->flush();
+        logger.reset();
+        spdlog::drop_all();
     };
 
 } // namespace log
@@ -1,5 +1,7 @@
 #include "extension.h"
 
+#include <cstring>
+
 //#define R3_CONSOLE
 #ifndef R3_CONSOLE
 
@@ -24,6 +26,8 @@ BOOL APIENTRY DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) {
 
 extern "C" {
     __declspec(dllexport) void __stdcall RVExtension(char *output, int outputSize, const char *function);
+    __declspec(dllexport) int __stdcall RVExtensionArgs(char *output, int outputSize, const char *function, const char **argv, int argc);
+    __declspec(dllexport) void __stdcall RVExtensionVersion(char *output, int outputSize);
 };
 
 void __stdcall RVExtension(char *output, int outputSize, const char *function) {
@@ -31,11 +35,23 @@ void __stdcall RVExtension(char *output, int outputSize, const char *function) {
     r3::extension::call(output, outputSize, function);
 };
 
+int __stdcall RVExtensionArgs(char *output, int outputSize, const char *function, const char **argv, int argc) {
+    outputSize -= 1;
+    return r3::extension::callArgs(output, outputSize, function, argv, argc);
+};
+
+void __stdcall RVExtensionVersion(char *output, int outputSize) {
+    std::strncpy(output, R3_EXTENSION_VERSION, outputSize - 1);
+    output[outputSize - 1] = '\0';
+};
+
 // Linux with GCC
 #else
 
 extern "C" {
     void RVExtension(char *output, int outputSize, const char *function);
+    int RVExtensionArgs(char *output, int outputSize, const char *function, const char **argv, int argc);
+    void RVExtensionVersion(char *output, int outputSize);
 }
 
 void RVExtension(char *output, int outputSize, const char *function) {
@@ -43,6 +59,16 @@ void RVExtension(char *output, int outputSize, const char *function) {
     r3::extension::call(output, outputSize, function);
 }
 
+int RVExtensionArgs(char *output, int outputSize, const char *function, const char **argv, int argc) {
+    outputSize -= 1;
+    return r3::extension::callArgs(output, outputSize, function, argv, argc);
+}
+
+void RVExtensionVersion(char *output, int outputSize) {
+    std::strncpy(output, R3_EXTENSION_VERSION, outputSize - 1);
+    output[outputSize - 1] = '\0';
+}
+
 __attribute__((constructor))
 static void extension_init() {
     r3::extension::initialize();
@@ -59,6 +85,33 @@ static void extension_finalize() {
 
 #include <iostream>
 #include <string>
+#include <vector>
+
+// Splits 'args <function> <arg>...' at spaces outside of double quotes. Quotes are kept,
+// so strings reach RVExtensionArgs as SQF passes them, e.g. args event 1 "Some Player" "hit"
+void callArgs(const std::string& line, char* output, int outputSize) {
+    std::vector<std::string> words;
+    bool quoted = false;
+    for (size_t i = 0; i < line.size(); i++) {
+        if (line[i] == ' ' && !quoted) {
+            if (!words.empty() && !words.back().empty()) { words.emplace_back(); }
+            continue;
+        }
+        if (words.empty()) { words.emplace_back(); }
+        if (line[i] == '"') { quoted = !quoted; }
+        words.back() += line[i];
+    }
+    if (!words.empty() && words.back().empty()) { words.pop_back(); }
+    if (words.size() < 2) {
+        std::strcpy(output, "Usage: args <function> <arg>...");
+        return;
+    }
+    std::vector<const char*> args;
+    for (size_t i = 2; i < words.size(); i++) {
+        args.push_back(words[i].c_str());
+    }
+    r3::extension::callArgs(output, outputSize, words[1].c_str(), args.data(), static_cast<int>(args.size()));
+}
 
 int main(int argc, char* argv[]) {
     std::string line = "";
@@ -69,10 +122,17 @@ int main(int argc, char* argv[]) {
     std::cout
         << "Type 'exit' to close console." << std::endl
         << "You first have to connect to the DB with 'connect'" << std::endl
+        << "Lines starting with 'args' call RVExtensionArgs, e.g. args event 1 \"76561198000000000\" \"hit\" \"\" 12.5" << std::endl
         << std::endl << std::endl;
     while (line != "exit") {
         std::getline(std::cin, line);
-        r3::extension::call(output, outputSize, line.c_str());
+        // Same as RVExtension, which reserves the last byte for the terminator.
+        if (line.compare(0, 5, "args ") == 0) {
+            callArgs(line, output, outputSize - 1);
+        }
+        else {
+            r3::extension::call(output, outputSize - 1, line.c_str());
+        }
         std::cout << "R3: " << output << std::endl;
     }
     r3::extension::finalize();
@@ -0,0 +1,135 @@
+#include "sink.h"
+
+#include "log.h"
+
+
+namespace r3 {
+namespace sink {
+
+    MemorySink::MemorySink(bool keepRows) : keepRows_(keepRows), committedRows_(0), nextReplayId_(1) {}
+
+    void MemorySink::initialize(size_t workers, size_t batchSize, bool keyedEvents) {
+        workers_.assign(workers, Worker{ false, 0, {}, {}, {}, 0, 0, 0 });
+        committedRows_ = 0;
+        for (auto& table : keys_) {
+            table.clear();
+        }
+    }
+
+    void MemorySink::start() {}
+
+    void MemorySink::finalize() {
+        log::logger->info("Memory sink committed '{}' rows.", committedRows_);
+        workers_.clear();
+    }
+
+    std::string MemorySink::describe() const {
+        return keepRows_ ? "memory sink" : "null sink";
+    }
+
+    void MemorySink::connect(size_t worker) {
+        rollback(worker);
+    }
+
+    void MemorySink::reset(size_t worker) {}
+
+    bool MemorySink::isSessionLost(const Poco::Data::DataException& e) const {
+        return false;
+    }
+
+    void MemorySink::begin(size_t worker) {
+        workers_[worker].inTransaction = true;
+    }
+
+    void MemorySink::commit(size_t worker) {
+        autoCommit(workers_[worker]);
+        workers_[worker].inTransaction = false;
+    }
+
+    void MemorySink::rollback(size_t worker) {
+        Worker& state = workers_[worker];
+        state.replays.resize(state.committedReplays);
+        state.players.resize(state.committedPlayers);
+        state.events.resize(state.committedEvents);
+        state.pendingRows = 0;
+        state.inTransaction = false;
+    }
+
+    void MemorySink::insert(size_t worker, const std::vector<ReplayRow>& rows) {
+        add(workers_[worker], workers_[worker].replays, rows);
+    }
+
+    void MemorySink::insert(size_t worker, const std::vector<PlayerRow>& rows) {
+        add(workers_[worker], workers_[worker].players, rows);
+    }
+
+    void MemorySink::insert(size_t worker, const std::vector<TouchRow>& rows) {
+        Worker& state = workers_[worker];
+        state.pendingRows += rows.size();
+        if (!state.inTransaction) { autoCommit(state); }
+    }
+
+    void MemorySink::insert(size_t worker, const std::vector<EventRow>& rows) {
+        add(workers_[worker], workers_[worker].events, rows);
+    }
+
+    uint32_t MemorySink::insertReplay(size_t worker, const ReplayRow& row) {
+        std::vector<ReplayRow> rows(1, row);
+        {
+            std::lock_guard<std::mutex> lock(replayIdsMutex_);
+            rows[0].id = nextReplayId_++;
+        }
+        insert(worker, rows);
+        return rows[0].id;
+    }
+
+    uint32_t MemorySink::reserveReplayIds(size_t worker, uint32_t count) {
+        std::lock_guard<std::mutex> lock(replayIdsMutex_);
+        nextReplayId_ += count;
+        return nextReplayId_;
+    }
+
+    void MemorySink::loadEvents(size_t worker, const std::string& path, size_t rows) {
+        committedRows_.fetch_add(rows, std::memory_order_relaxed);
+    }
+
+    void MemorySink::loadKeys(size_t worker, Dictionary dictionary, std::unordered_map<std::string, uint32_t>& keys) {
+        std::lock_guard<std::mutex> lock(keysMutex_);
+        const auto& table = keys_[static_cast<size_t>(dictionary)];
+        keys.insert(table.begin(), table.end());
+    }
+
+    // Keys start at 1 like an auto increment column.
+    uint32_t MemorySink::insertKey(size_t worker, Dictionary dictionary, const std::string& name) {
+        std::lock_guard<std::mutex> lock(keysMutex_);
+        auto& table = keys_[static_cast<size_t>(dictionary)];
+        return table.emplace(name, static_cast<uint32_t>(table.size() + 1)).first->second;
+    }
+
+    uint64_t MemorySink::getCommittedRows() const {
+        return committedRows_.load(std::memory_order_relaxed);
+    }
+
+    const std::vector<EventRow>& MemorySink::getEvents(size_t worker) const {
+        return workers_[worker].events;
+    }
+
+    template <typename Row>
+    void MemorySink::add(Worker& worker, std::vector<Row>& table, const std::vector<Row>& rows) {
+        if (keepRows_) {
+            table.insert(table.end(), rows.begin(), rows.end());
+        }
+        worker.pendingRows += rows.size();
+        if (!worker.inTransaction) { autoCommit(worker); }
+    }
+
+    void MemorySink::autoCommit(Worker& worker) {
+        committedRows_.fetch_add(worker.pendingRows, std::memory_order_relaxed);
+        worker.pendingRows = 0;
+        worker.committedReplays = worker.replays.size();
+        worker.committedPlayers = worker.players.size();
+        worker.committedEvents = worker.events.size();
+    }
+
+} // namespace sink
+} // namespace r3
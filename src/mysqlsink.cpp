@@ -0,0 +1,405 @@
+#include "sink.h"
+
+#include "commands.h"
+#include "log.h"
+
+#include "Poco/Data/Session.h"
+#include "Poco/Data/MySQL/MySQLException.h"
+#include "Poco/Data/MySQL/Connector.h"
+
+#include <mysql.h>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+
+namespace r3 {
+namespace sink {
+
+namespace {
+    // Replay ids are reserved in blocks from a single row sequence table, which must be created with
+    //   CREATE TABLE replayIds (nextId INT UNSIGNED NOT NULL) ENGINE=InnoDB;
+    //   INSERT INTO replayIds SELECT IFNULL(MAX(id), 0) + 1 FROM replays;
+    // The UPDATE is atomic, so several servers can share one sequence. Ids left in a block on shutdown are skipped.
+    const std::string RESERVE_REPLAY_IDS = "UPDATE replayIds SET nextId = LAST_INSERT_ID(nextId + ?)";
+    // LOAD DATA is not supported by the prepared statement protocol, it is sent as a plain query on a
+    // connection of its own. The server only accepts LOCAL files from a client that asked for them
+    // when connecting, which the session options of Poco do not allow.
+    const std::string LOAD_EVENTS = "LOAD DATA LOCAL INFILE '{}' INTO TABLE events CHARACTER SET utf8mb4 "
+        "FIELDS TERMINATED BY '\\t' ESCAPED BY '\\\\' LINES TERMINATED BY '\\n' "
+        "(replayId, playerId, type, value, missionTime) SET added = NOW()";
+
+    // Events written with dictionary keys, the lookup tables must be created with
+    //   CREATE TABLE eventTypes (id SMALLINT UNSIGNED NOT NULL AUTO_INCREMENT PRIMARY KEY, type VARCHAR(64) NOT NULL UNIQUE) ENGINE=InnoDB;
+    //   CREATE TABLE playerKeys (id INT UNSIGNED NOT NULL AUTO_INCREMENT PRIMARY KEY, playerId VARCHAR(64) NOT NULL UNIQUE) ENGINE=InnoDB;
+    // and the events table needs the columns typeKey SMALLINT UNSIGNED and playerKey INT UNSIGNED, with type and playerId nullable.
+    const commands::Definition KEYED_EVENT = { "event", Command::Event, commands::Handling::Queued, 5,
+        { commands::Param::Unsigned, commands::Param::String, commands::Param::String, commands::Param::String, commands::Param::Float },
+        "INSERT INTO events(replayId, playerKey, typeKey, value, missionTime, added) VALUES ", "(?, ?, ?, ?, ?, NOW())", "" };
+
+    // Lookup table and name column of each dictionary, indexed by Dictionary.
+    const char* const KEY_TABLES[][2] = {
+        { "eventTypes", "type" },
+        { "playerKeys", "playerId" }
+    };
+    const std::string SELECT_KEYS = "SELECT {1}, id FROM {0}";
+    // Inserting an existing name sets LAST_INSERT_ID to its key, so concurrent writers agree on the key.
+    const std::string INSERT_KEY = "INSERT INTO {0}({1}) VALUES (?) ON DUPLICATE KEY UPDATE id = LAST_INSERT_ID(id)";
+
+    // The statement text of a command comes from its definition in the command registry.
+    std::string buildInsert(const commands::Definition& definition, size_t rows) {
+        std::string row = definition.insertRow;
+        std::string sql = definition.insertHead;
+        sql.reserve(sql.size() + (row.size() + 1) * rows + std::strlen(definition.insertTail));
+        for (size_t i = 0; i < rows; i++) {
+            if (i > 0) { sql += ','; }
+            sql += row;
+        }
+        sql += definition.insertTail;
+        return sql;
+    }
+
+    std::string quotePath(const std::string& path) {
+        std::string quoted;
+        for (char c : path) {
+            if (c == '\\' || c == '\'') { quoted += '\\'; }
+            quoted += c;
+        }
+        return quoted;
+    }
+
+    const commands::Definition& getDefinition(const ReplayRow&, bool) { return commands::get(Command::InsertReplay); }
+    const commands::Definition& getDefinition(const PlayerRow&, bool) { return commands::get(Command::Player); }
+    const commands::Definition& getDefinition(const TouchRow&, bool) { return commands::get(Command::TouchPlayers); }
+    const commands::Definition& getDefinition(const EventRow&, bool keyed) { return keyed ? KEYED_EVENT : commands::get(Command::Event); }
+
+    void bind(Poco::Data::Statement& statement, ReplayRow& row, bool) {
+        statement,
+            Poco::Data::Keywords::use(row.id),
+            Poco::Data::Keywords::use(row.missionName),
+            Poco::Data::Keywords::use(row.map),
+            Poco::Data::Keywords::use(row.dayTime),
+            Poco::Data::Keywords::use(row.addonVersion);
+    }
+
+    void bind(Poco::Data::Statement& statement, PlayerRow& row, bool) {
+        statement,
+            Poco::Data::Keywords::use(row.id),
+            Poco::Data::Keywords::use(row.name);
+    }
+
+    void bind(Poco::Data::Statement& statement, TouchRow& row, bool) {
+        statement,
+            Poco::Data::Keywords::use(row.id);
+    }
+
+    void bind(Poco::Data::Statement& statement, EventRow& row, bool keyed) {
+        if (keyed) {
+            statement,
+                Poco::Data::Keywords::use(row.replayId),
+                Poco::Data::Keywords::use(row.playerKey),
+                Poco::Data::Keywords::use(row.typeKey),
+                Poco::Data::Keywords::use(row.value),
+                Poco::Data::Keywords::use(row.missionTime);
+            return;
+        }
+        statement,
+            Poco::Data::Keywords::use(row.replayId),
+            Poco::Data::Keywords::use(row.playerId),
+            Poco::Data::Keywords::use(row.type),
+            Poco::Data::Keywords::use(row.value),
+            Poco::Data::Keywords::use(row.missionTime);
+    }
+
+    // A multi-row INSERT prepared once for a fixed number of rows. It is bound to
+    // its own row storage, so executing it again only copies in the new values.
+    template <typename Row>
+    struct BatchStatement {
+        std::vector<Row> rows;
+        Poco::Data::Statement statement;
+
+        BatchStatement(Poco::Data::Session& session, size_t size, bool keyed) : rows(size), statement(session) {
+            statement << buildInsert(getDefinition(Row(), keyed), size);
+            for (auto& row : rows) {
+                bind(statement, row, keyed);
+            }
+        }
+    };
+
+    struct ReplayStatement {
+        ReplayRow row;
+        uint32_t replayId;
+        Poco::Data::Statement insert;
+        Poco::Data::Statement lastInsertId;
+
+        ReplayStatement(Poco::Data::Session& session) : row(), replayId(0), insert(session), lastInsertId(session) {
+            insert << buildInsert(commands::get(Command::Replay), 1),
+                Poco::Data::Keywords::use(row.missionName),
+                Poco::Data::Keywords::use(row.map),
+                Poco::Data::Keywords::use(row.dayTime),
+                Poco::Data::Keywords::use(row.addonVersion);
+            lastInsertId << "SELECT LAST_INSERT_ID()",
+                Poco::Data::Keywords::into(replayId);
+        }
+    };
+
+    struct ReserveStatement {
+        uint32_t count;
+        uint32_t nextId;
+        Poco::Data::Statement reserve;
+        Poco::Data::Statement lastInsertId;
+
+        ReserveStatement(Poco::Data::Session& session) : count(0), nextId(0), reserve(session), lastInsertId(session) {
+            reserve << RESERVE_REPLAY_IDS,
+                Poco::Data::Keywords::use(count);
+            lastInsertId << "SELECT LAST_INSERT_ID()",
+                Poco::Data::Keywords::into(nextId);
+        }
+    };
+
+    struct KeyStatement {
+        std::string name;
+        uint32_t key;
+        Poco::Data::Statement insert;
+        Poco::Data::Statement lastInsertId;
+
+        KeyStatement(Poco::Data::Session& session, Dictionary dictionary) : key(0), insert(session), lastInsertId(session) {
+            const char* const* table = KEY_TABLES[static_cast<size_t>(dictionary)];
+            insert << fmt::format(INSERT_KEY, table[0], table[1]),
+                Poco::Data::Keywords::use(name);
+            lastInsertId << "SELECT LAST_INSERT_ID()",
+                Poco::Data::Keywords::into(key);
+        }
+    };
+
+    struct LoaderDeleter {
+        void operator()(MYSQL* handle) const {
+            mysql_close(handle);
+        }
+    };
+
+    typedef std::unique_ptr<MYSQL, LoaderDeleter> Loader;
+
+    // Batch statements are cached per power of two row count, any batch is written as at most log2(batch size) chunks.
+    struct StatementCache {
+        std::unique_ptr<ReplayStatement> replay;
+        std::unique_ptr<ReserveStatement> reserve;
+        std::unique_ptr<KeyStatement> keys[static_cast<size_t>(Dictionary::Count)];
+        std::map<size_t, std::unique_ptr<BatchStatement<ReplayRow>>> replays;
+        std::map<size_t, std::unique_ptr<BatchStatement<PlayerRow>>> players;
+        std::map<size_t, std::unique_ptr<BatchStatement<TouchRow>>> touches;
+        std::map<size_t, std::unique_ptr<BatchStatement<EventRow>>> events;
+
+        void clear() {
+            replay.reset();
+            reserve.reset();
+            for (auto& key : keys) {
+                key.reset();
+            }
+            replays.clear();
+            players.clear();
+            touches.clear();
+            events.clear();
+        }
+    };
+
+    class MySQLSink : public Sink {
+    public:
+        MySQLSink(const std::string& host, uint32_t port, const std::string& database, const std::string& user, const std::string& password, size_t timeout) :
+            host_(host), database_(database), user_(user), password_(password), port_(port), timeout_(timeout), maxChunkSize_(1), keyedEvents_(false), started_(false) {}
+
+        ~MySQLSink() {
+            finalize();
+        }
+
+        void initialize(size_t workers, size_t batchSize, bool keyedEvents) override {
+            keyedEvents_ = keyedEvents;
+            maxChunkSize_ = 1;
+            while (maxChunkSize_ * 2 <= batchSize) { maxChunkSize_ <<= 1; }
+            statementCaches_.resize(workers);
+            sessions_.resize(workers);
+            loaders_.resize(workers);
+        }
+
+        void start() override {
+            if (started_) { return; }
+            Poco::Data::MySQL::Connector::registerConnector();
+            started_ = true;
+        }
+
+        void finalize() override {
+            statementCaches_.clear();
+            loaders_.clear();
+            sessions_.clear();
+            if (started_) {
+                Poco::Data::MySQL::Connector::unregisterConnector();
+            }
+            started_ = false;
+        }
+
+        std::string describe() const override {
+            return fmt::format("MySQL server at '{}@{}:{}/{}'", user_, host_, port_, database_);
+        }
+
+        void connect(size_t worker) override {
+            statementCaches_[worker].clear();
+            loaders_[worker].reset();
+            sessions_[worker].reset();
+            sessions_[worker].reset(new Poco::Data::Session("MySQL", fmt::format("host={};port={};db={};user={};password={};compress=true;auto-reconnect=true", host_, port_, database_, user_, password_), timeout_));
+        }
+
+        void reset(size_t worker) override {
+            statementCaches_[worker].clear();
+        }
+
+        // MySQL error codes after which the server side prepared statements are gone.
+        bool isSessionLost(const Poco::Data::DataException& e) const override {
+            return e.code() == 1243 || e.code() == 2006 || e.code() == 2013 || e.code() == 2055;
+        }
+
+        void begin(size_t worker) override {
+            sessions_[worker]->begin();
+        }
+
+        void commit(size_t worker) override {
+            sessions_[worker]->commit();
+        }
+
+        void rollback(size_t worker) override {
+            sessions_[worker]->rollback();
+        }
+
+        void insert(size_t worker, const std::vector<ReplayRow>& rows) override {
+            insertRows(worker, statementCaches_[worker].replays, rows);
+        }
+
+        void insert(size_t worker, const std::vector<PlayerRow>& rows) override {
+            insertRows(worker, statementCaches_[worker].players, rows);
+        }
+
+        void insert(size_t worker, const std::vector<TouchRow>& rows) override {
+            insertRows(worker, statementCaches_[worker].touches, rows);
+        }
+
+        void insert(size_t worker, const std::vector<EventRow>& rows) override {
+            insertRows(worker, statementCaches_[worker].events, rows);
+        }
+
+        uint32_t insertReplay(size_t worker, const ReplayRow& row) override {
+            StatementCache& statements = statementCaches_[worker];
+            if (!statements.replay) {
+                statements.replay.reset(new ReplayStatement(*sessions_[worker]));
+            }
+            ReplayStatement& replay = *statements.replay;
+            replay.row = row;
+            replay.insert.execute();
+            replay.lastInsertId.execute();
+            return replay.replayId;
+        }
+
+        uint32_t reserveReplayIds(size_t worker, uint32_t count) override {
+            StatementCache& statements = statementCaches_[worker];
+            if (!statements.reserve) {
+                statements.reserve.reset(new ReserveStatement(*sessions_[worker]));
+            }
+            ReserveStatement& reserve = *statements.reserve;
+            reserve.count = count;
+            if (reserve.reserve.execute() == 0) { return 0; }
+            reserve.lastInsertId.execute();
+            return reserve.nextId;
+        }
+
+        void loadEvents(size_t worker, const std::string& path, size_t rows) override {
+            MYSQL* handle = getLoader(worker);
+            std::string sql = fmt::format(LOAD_EVENTS, quotePath(path));
+            if (mysql_real_query(handle, sql.data(), static_cast<unsigned long>(sql.size())) != 0) {
+                throw Poco::Data::MySQL::MySQLException(mysql_error(handle), static_cast<int>(mysql_errno(handle)));
+            }
+            uint64_t loaded = mysql_affected_rows(handle);
+            if (loaded != rows) {
+                log::logger->warn("Loaded '{}' of '{}' rows from staging file '{}'.", loaded, rows, path);
+            }
+        }
+
+        void loadKeys(size_t worker, Dictionary dictionary, std::unordered_map<std::string, uint32_t>& keys) override {
+            const char* const* table = KEY_TABLES[static_cast<size_t>(dictionary)];
+            std::vector<std::string> names;
+            std::vector<uint32_t> ids;
+            Poco::Data::Statement select(*sessions_[worker]);
+            select << fmt::format(SELECT_KEYS, table[0], table[1]),
+                Poco::Data::Keywords::into(names),
+                Poco::Data::Keywords::into(ids);
+            select.execute();
+            keys.reserve(keys.size() + names.size());
+            for (size_t i = 0; i < names.size() && i < ids.size(); i++) {
+                keys.emplace(std::move(names[i]), ids[i]);
+            }
+        }
+
+        uint32_t insertKey(size_t worker, Dictionary dictionary, const std::string& name) override {
+            StatementCache& statements = statementCaches_[worker];
+            auto& statement = statements.keys[static_cast<size_t>(dictionary)];
+            if (!statement) {
+                statement.reset(new KeyStatement(*sessions_[worker], dictionary));
+            }
+            statement->name = name;
+            statement->insert.execute();
+            statement->lastInsertId.execute();
+            return statement->key;
+        }
+
+    private:
+        // Opened on the first load after each connect, with LOCAL files enabled before the handshake.
+        MYSQL* getLoader(size_t worker) {
+            if (loaders_[worker]) { return loaders_[worker].get(); }
+            Loader loader(mysql_init(nullptr));
+            if (!loader) {
+                throw Poco::Data::MySQL::MySQLException("Failed to allocate a MySQL handle");
+            }
+            unsigned int timeout = static_cast<unsigned int>(timeout_);
+            unsigned int localInfile = 1;
+            mysql_options(loader.get(), MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+            mysql_options(loader.get(), MYSQL_OPT_COMPRESS, nullptr);
+            mysql_options(loader.get(), MYSQL_OPT_LOCAL_INFILE, &localInfile);
+            if (mysql_real_connect(loader.get(), host_.c_str(), user_.c_str(), password_.c_str(), database_.c_str(), port_, nullptr, 0) == nullptr) {
+                throw Poco::Data::MySQL::MySQLException(mysql_error(loader.get()), static_cast<int>(mysql_errno(loader.get())));
+            }
+            loaders_[worker] = std::move(loader);
+            return loaders_[worker].get();
+        }
+
+        template <typename Row>
+        void insertRows(size_t worker, std::map<size_t, std::unique_ptr<BatchStatement<Row>>>& statements, const std::vector<Row>& rows) {
+            size_t offset = 0;
+            while (offset < rows.size()) {
+                size_t chunk = maxChunkSize_;
+                while (chunk > rows.size() - offset) { chunk >>= 1; }
+                auto& statement = statements[chunk];
+                if (!statement) {
+                    statement.reset(new BatchStatement<Row>(*sessions_[worker], chunk, keyedEvents_));
+                }
+                std::copy(rows.begin() + offset, rows.begin() + offset + chunk, statement->rows.begin());
+                statement->statement.execute();
+                offset += chunk;
+            }
+        }
+
+        std::string host_, database_, user_, password_;
+        uint32_t port_;
+        size_t timeout_;
+        size_t maxChunkSize_;
+        bool keyedEvents_;
+        bool started_;
+        std::vector<std::unique_ptr<Poco::Data::Session>> sessions_;
+        std::vector<Loader> loaders_;
+        std::vector<StatementCache> statementCaches_;
+    };
+}
+
+    std::unique_ptr<Sink> createMySQL(const std::string& host, uint32_t port, const std::string& database, const std::string& user, const std::string& password, size_t timeout) {
+        return std::unique_ptr<Sink>(new MySQLSink(host, port, database, user, password, timeout));
+    }
+
+} // namespace sink
+} // namespace r3
@@ -0,0 +1,316 @@
+#include "remote.h"
+
+#include "extension.h"
+#include "journal.h"
+#include "log.h"
+#include "util.h"
+
+#include "Poco/Exception.h"
+#include "Poco/File.h"
+#include "Poco/Path.h"
+#include "Poco/SharedMemory.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+
+
+namespace r3 {
+namespace remote {
+
+namespace {
+    const std::string RING_FILE = "writer.r3r";
+    const char MAGIC[8] = { 'R', '3', 'R', 'I', 'N', 'G', '0', '2' };
+    const size_t HEADER_SIZE = 4096;
+    const size_t RESULT_RING_SIZE = 1024 * 1024;
+    const uint64_t HEARTBEAT_TIMEOUT = 3000;
+    const std::chrono::milliseconds OPEN_TIMEOUT(2000);
+    const std::chrono::milliseconds OPEN_RETRY_INTERVAL(10);
+
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "The rings need lock free 64 bit atomics to be shared between processes.");
+
+    // Positions only grow, the byte at a position is at data[position & (capacity - 1)]. A record is
+    // published by moving writePos past it, so a reader never sees a partly written record.
+    struct RingState {
+        alignas(64) std::atomic<uint64_t> writePos;
+        alignas(64) std::atomic<uint64_t> readPos;
+    };
+
+    // Written by whichever process creates the file, the magic is written last. The file is kept,
+    // so requests the daemon has not read yet survive until it runs again. The heartbeat is steady
+    // clock milliseconds, which count from boot for every process on the supported platforms. The
+    // owner is the epoch of the process reading the request ring shifted left by one, with the
+    // lowest bit set for the daemon. Each claim moves the epoch on.
+    struct Header {
+        char magic[8];
+        uint64_t requestCapacity;
+        uint64_t resultCapacity;
+        RingState requests;
+        RingState results;
+        alignas(64) std::atomic<uint64_t> heartbeat;
+        std::atomic<uint32_t> connectedWorkers;
+        std::atomic<uint32_t> poolSize;
+        char state[32];
+        alignas(64) std::atomic<uint64_t> owner;
+    };
+
+    static_assert(sizeof(Header) <= HEADER_SIZE, "The ring header must fit into HEADER_SIZE.");
+
+    struct Ring {
+        RingState* state;
+        char* data;
+        uint64_t capacity;
+    };
+
+    bool enabled = false;
+    Side side;
+    std::unique_ptr<Poco::SharedMemory> memory;
+    Header* header = nullptr;
+    Ring requestRing;
+    Ring resultRing;
+    // Several threads of a process write to its ring, the other process is the only reader. The
+    // extension only reads its own ring once it took it over from a daemon whose heartbeat is lost.
+    std::mutex pushMutex;
+    // The owner value of this process' last claim, 0 if it never claimed the request ring.
+    uint64_t claimed = 0;
+    std::string record;
+    std::string readBuffer;
+}
+
+    uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void copyIn(Ring& ring, uint64_t position, const char* data, size_t size) {
+        size_t offset = static_cast<size_t>(position & (ring.capacity - 1));
+        size_t first = std::min<size_t>(size, ring.capacity - offset);
+        std::memcpy(ring.data + offset, data, first);
+        std::memcpy(ring.data, data + first, size - first);
+    }
+
+    void copyOut(Ring& ring, uint64_t position, char* data, size_t size) {
+        size_t offset = static_cast<size_t>(position & (ring.capacity - 1));
+        size_t first = std::min<size_t>(size, ring.capacity - offset);
+        std::memcpy(data, ring.data + offset, first);
+        std::memcpy(data + first, ring.data, size - first);
+    }
+
+    bool write(Ring& ring, const std::string& record) {
+        uint64_t writePos = ring.state->writePos.load(std::memory_order_relaxed);
+        uint64_t readPos = ring.state->readPos.load(std::memory_order_acquire);
+        if (ring.capacity - (writePos - readPos) < record.size()) { return false; }
+        copyIn(ring, writePos, record.data(), record.size());
+        ring.state->writePos.store(writePos + record.size(), std::memory_order_release);
+        return true;
+    }
+
+    // Leaves the next record without its length in buffer, false if the ring is empty. A record is
+    // only taken by moving readPos past it, so a reader that lost the ring while copying never takes
+    // a record the new owner took as well.
+    bool read(Ring& ring, std::string& buffer) {
+        while (true) {
+            uint64_t readPos = ring.state->readPos.load(std::memory_order_acquire);
+            uint64_t writePos = ring.state->writePos.load(std::memory_order_acquire);
+            if (writePos - readPos < sizeof(uint32_t)) { return false; }
+            uint32_t length = 0;
+            copyOut(ring, readPos, reinterpret_cast<char*>(&length), sizeof(uint32_t));
+            if (length < sizeof(uint32_t) || length > writePos - readPos) {
+                if (ring.state->readPos.compare_exchange_strong(readPos, writePos, std::memory_order_acq_rel)) {
+                    log::logger->error("Skipping '{}' bytes of a corrupt writer ring!", writePos - readPos);
+                    return false;
+                }
+                continue;
+            }
+            buffer.resize(length - sizeof(uint32_t));
+            copyOut(ring, readPos + sizeof(uint32_t), &buffer[0], buffer.size());
+            if (ring.state->readPos.compare_exchange_strong(readPos, readPos + length, std::memory_order_acq_rel)) {
+                return true;
+            }
+        }
+    }
+
+    // Moves the owner epoch on, false if another process claimed the ring meanwhile.
+    bool claim() {
+        uint64_t current = header->owner.load(std::memory_order_acquire);
+        uint64_t next = (((current >> 1) + 1) << 1) | (side == Side::Writer ? 1 : 0);
+        if (!header->owner.compare_exchange_strong(current, next, std::memory_order_acq_rel)) { return false; }
+        claimed = next;
+        return true;
+    }
+
+    void finishRecord(std::string& record) {
+        uint32_t length = static_cast<uint32_t>(record.size());
+        std::memcpy(&record[0], &length, sizeof(uint32_t));
+    }
+
+    bool isReady(const Poco::File& file) {
+        if (file.getSize() < HEADER_SIZE) { return false; }
+        memory.reset(new Poco::SharedMemory(file, Poco::SharedMemory::AM_WRITE));
+        header = reinterpret_cast<Header*>(memory->begin());
+        bool ready = std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) == 0;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (ready && static_cast<size_t>(memory->end() - memory->begin()) >= HEADER_SIZE + header->requestCapacity + header->resultCapacity) {
+            return true;
+        }
+        header = nullptr;
+        memory.reset();
+        return false;
+    }
+
+    bool initialize(const std::string& extensionFolder, size_t ringSize, Side side_) {
+        side = side_;
+        std::string path = fmt::format("{}{}{}", extensionFolder, Poco::Path::separator(), RING_FILE);
+        try {
+            Poco::File file(path);
+            if (file.createFile()) {
+                uint64_t requestCapacity = util::roundUpToPowerOfTwo(ringSize);
+                file.setSize(HEADER_SIZE + requestCapacity + RESULT_RING_SIZE);
+                memory.reset(new Poco::SharedMemory(file, Poco::SharedMemory::AM_WRITE));
+                header = new (memory->begin()) Header();
+                header->requestCapacity = requestCapacity;
+                header->resultCapacity = RESULT_RING_SIZE;
+                std::atomic_thread_fence(std::memory_order_release);
+                std::memcpy(header->magic, MAGIC, sizeof(MAGIC));
+            }
+            else {
+                // The other process may be creating the file right now.
+                auto deadline = std::chrono::steady_clock::now() + OPEN_TIMEOUT;
+                while (!isReady(file)) {
+                    if (std::chrono::steady_clock::now() > deadline) {
+                        log::logger->error("Writer ring '{}' is not valid, delete it while neither the game nor r3_writer runs.", path);
+                        return false;
+                    }
+                    std::this_thread::sleep_for(OPEN_RETRY_INTERVAL);
+                }
+            }
+        }
+        catch (Poco::Exception& e) {
+            log::logger->error("Failed to open writer ring '{}'! Error message: {}", path, e.displayText());
+            header = nullptr;
+            memory.reset();
+            return false;
+        }
+        char* data = memory->begin() + HEADER_SIZE;
+        requestRing = Ring{ &header->requests, data, header->requestCapacity };
+        resultRing = Ring{ &header->results, data + header->requestCapacity, header->resultCapacity };
+        // A daemon takes over from whoever read the ring before it, a stalled daemon stops once it sees that.
+        if (side == Side::Writer) {
+            while (!claim()) {}
+        }
+        enabled = true;
+        uint64_t pending = header->requests.writePos.load() - header->requests.readPos.load();
+        log::logger->info("Opened writer ring '{}' with '{}' bytes of pending requests.", path, pending);
+        return true;
+    }
+
+    void finalize() {
+        if (!enabled) { return; }
+        if (side == Side::Writer) {
+            header->heartbeat.store(0, std::memory_order_release);
+        }
+        enabled = false;
+        claimed = 0;
+        header = nullptr;
+        memory.reset();
+    }
+
+    bool isEnabled() {
+        return enabled;
+    }
+
+    bool isWriterAlive() {
+        return enabled && now() < header->heartbeat.load(std::memory_order_acquire) + HEARTBEAT_TIMEOUT;
+    }
+
+    bool isOwner() {
+        return enabled && claimed != 0 && header->owner.load(std::memory_order_acquire) == claimed;
+    }
+
+    bool takeOver() {
+        return enabled && (isOwner() || claim());
+    }
+
+    // Requests are sent as [uint32 length][uint32 ticket] followed by the journal record after its length.
+    bool push(const Request& request) {
+        if (!enabled) { return false; }
+        std::lock_guard<std::mutex> lock(pushMutex);
+        journal::encode(request, record);
+        record.insert(sizeof(uint32_t), reinterpret_cast<const char*>(&request.ticket), sizeof(uint32_t));
+        finishRecord(record);
+        return write(requestRing, record);
+    }
+
+    bool pop(Request& request) {
+        if (!isOwner()) { return false; }
+        while (read(requestRing, readBuffer)) {
+            uint32_t ticket = 0;
+            const char* begin = readBuffer.data();
+            const char* end = begin + readBuffer.size();
+            if (readBuffer.size() >= sizeof(uint32_t) && journal::decode(begin + sizeof(uint32_t), end, request)) {
+                std::memcpy(&ticket, begin, sizeof(uint32_t));
+                request.ticket = ticket;
+                return true;
+            }
+            log::logger->error("Dropping corrupt request of '{}' bytes from the writer ring!", readBuffer.size());
+        }
+        return false;
+    }
+
+    // Results are sent as [uint32 length][uint32 ticket][uint16 type size][type][data].
+    bool pushResult(uint32_t ticket, const Response& response) {
+        if (!enabled) { return false; }
+        std::lock_guard<std::mutex> lock(pushMutex);
+        uint16_t typeSize = static_cast<uint16_t>(response.type.size());
+        record.assign(sizeof(uint32_t), '\0');
+        record.append(reinterpret_cast<const char*>(&ticket), sizeof(uint32_t));
+        record.append(reinterpret_cast<const char*>(&typeSize), sizeof(uint16_t));
+        record += response.type;
+        record += response.data;
+        finishRecord(record);
+        return write(resultRing, record);
+    }
+
+    bool popResult(uint32_t& ticket, Response& response) {
+        if (!enabled) { return false; }
+        while (read(resultRing, readBuffer)) {
+            uint16_t typeSize = 0;
+            size_t headSize = sizeof(uint32_t) + sizeof(uint16_t);
+            if (readBuffer.size() >= headSize) {
+                std::memcpy(&ticket, readBuffer.data(), sizeof(uint32_t));
+                std::memcpy(&typeSize, readBuffer.data() + sizeof(uint32_t), sizeof(uint16_t));
+            }
+            if (readBuffer.size() < headSize + typeSize) {
+                log::logger->error("Dropping corrupt result of '{}' bytes from the writer ring!", readBuffer.size());
+                continue;
+            }
+            response.type.assign(readBuffer, headSize, typeSize);
+            response.data.assign(readBuffer, headSize + typeSize, std::string::npos);
+            return true;
+        }
+        return false;
+    }
+
+    void heartbeat(const std::string& state, size_t connectedWorkers, size_t poolSize) {
+        if (!enabled) { return; }
+        size_t stateSize = std::min(state.size(), sizeof(header->state) - 1);
+        std::memcpy(header->state, state.data(), stateSize);
+        header->state[stateSize] = '\0';
+        header->connectedWorkers.store(static_cast<uint32_t>(connectedWorkers), std::memory_order_relaxed);
+        header->poolSize.store(static_cast<uint32_t>(poolSize), std::memory_order_relaxed);
+        header->heartbeat.store(now(), std::memory_order_release);
+    }
+
+    void getWriterStatus(std::string& state, size_t& connectedWorkers, size_t& poolSize) {
+        if (!enabled) { return; }
+        state.assign(header->state, strnlen(header->state, sizeof(header->state)));
+        connectedWorkers = header->connectedWorkers.load(std::memory_order_relaxed);
+        poolSize = header->poolSize.load(std::memory_order_relaxed);
+    }
+
+} // namespace remote
+} // namespace r3
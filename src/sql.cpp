@@ -1,174 +1,709 @@
 #include "sql.h"
 
+#include "coalesce.h"
+#include "dictionary.h"
 #include "extension.h"
+#include "journal.h"
 #include "log.h"
+#include "sink.h"
+#include "staging.h"
+#include "stats.h"
+#include "tokenizer.h"
+#include "trace.h"
 
-#include "Poco/Nullable.h"
-#include "Poco/Data/Session.h"
-#include "Poco/Data/MySQL/MySQLException.h"
-#include "Poco/Data/MySQL/Connector.h"
+#include "Poco/Exception.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
 
 
 namespace r3 {
 namespace sql {
 
 namespace {
-    std::string host, database, user, password;
-    uint32_t port;
-    size_t timeout;
-    Poco::Data::Session* session;
-    std::mutex sessionMutex;
-    std::atomic<bool> connected;
+    const std::chrono::seconds RESERVE_RETRY_INTERVAL(10);
+
+    using sink::ReplayRow;
+    using sink::PlayerRow;
+    using sink::TouchRow;
+    using sink::EventRow;
+
+    std::unique_ptr<sink::Sink> rowSink;
+    size_t batchSize;
+    std::chrono::milliseconds batchLinger;
+    size_t poolSize;
+    std::chrono::milliseconds reconnectMin;
+    std::chrono::milliseconds reconnectMax;
+    std::atomic<bool> started(false);
+    std::atomic<bool> stopping(false);
+
+    // Connection state is owned by each worker thread, the counters let the game thread read the pool state.
+    std::vector<ConnectionState> workerStates;
+    std::vector<size_t> reconnectAttempts;
+    std::vector<std::chrono::steady_clock::time_point> nextAttempts;
+    std::vector<std::minstd_rand> randoms;
+    std::unique_ptr<std::atomic<bool>[]> runningWorkers;
+    std::atomic<size_t> connectedWorkers(0);
+    std::atomic<size_t> backoffWorkers(0);
+    std::mutex lastErrorMutex;
+    std::string lastError;
+
+    // Blocks of reserved replay ids as [first, end) ranges, refilled by any worker once half of a block is used.
+    uint32_t replayIdBlock;
+    std::mutex replayIdsMutex;
+    std::deque<std::pair<uint32_t, uint32_t>> replayIds;
+    size_t availableReplayIds = 0;
+    std::atomic<bool> reservingReplayIds(false);
+    std::chrono::steady_clock::time_point nextReserve;
+
+    const std::chrono::milliseconds IDLE_INTERVAL(1000);
+    const std::chrono::milliseconds STOP_CHECK_INTERVAL(100);
 }
 
-    uint32_t parseUnsigned(const std::string& str) {
-        uint32_t number = 0;
-        if (!Poco::NumberParser::tryParseUnsigned(str, number)) {
-            return 0;
+    bool parseReplay(const Request& request, ReplayRow& row) {
+        commands::Value values[commands::MAX_PARAMS];
+        if (!commands::decode(request, values)) { return false; }
+        row.missionName = values[0].text.str();
+        row.map = values[1].text.str();
+        row.dayTime = values[2].number;
+        row.addonVersion = values[3].text.str();
+        row.id = values[4].integer;
+        return true;
+    }
+
+    bool parsePlayer(const Request& request, PlayerRow& row) {
+        commands::Value values[commands::MAX_PARAMS];
+        if (!commands::decode(request, values)) { return false; }
+        row.id = values[0].text.str();
+        row.name = values[1].text.str();
+        return true;
+    }
+
+    bool parseEvent(const Request& request, EventRow& row) {
+        commands::Value values[commands::MAX_PARAMS];
+        if (!commands::decode(request, values)) { return false; }
+        row.replayId = values[0].integer;
+        row.playerId = values[1].text.str();
+        row.type = values[2].text.str();
+        row.value = values[3].text.str();
+        row.missionTime = values[4].number;
+        return true;
+    }
+
+    bool isSessionLost(const Poco::Data::DataException& e) {
+        return rowSink->isSessionLost(e);
+    }
+
+    void invalidateStatements(size_t worker, const Poco::Data::DataException& e) {
+        if (workerStates[worker] != ConnectionState::Connected) {
+            rowSink->reset(worker);
+            return;
+        }
+        stats::countError();
+        if (isSessionLost(e)) {
+            stats::countReconnect();
+            log::logger->warn("Worker '{}' lost its database session, prepared statements will be rebuilt. Error code: '{}'", worker, e.code());
+            rowSink->reset(worker);
         }
-        return number;
     }
 
-    double parseFloat(const std::string& str) {
-        double number = 0;
-        if (!Poco::NumberParser::tryParseFloat(str, number)) {
-            return 0;
+    void setState(size_t worker, ConnectionState state) {
+        ConnectionState previous = workerStates[worker];
+        if (previous == state) { return; }
+        if (previous == ConnectionState::Connected) { connectedWorkers--; }
+        if (previous == ConnectionState::Backoff) { backoffWorkers--; }
+        if (state == ConnectionState::Connected) { connectedWorkers++; }
+        if (state == ConnectionState::Backoff) { backoffWorkers++; }
+        workerStates[worker] = state;
+    }
+
+    void setLastError(const std::string& message) {
+        std::lock_guard<std::mutex> lock(lastErrorMutex);
+        lastError = message;
+    }
+
+    // Exponential backoff with equal jitter, so the workers of a pool do not retry in lockstep.
+    std::chrono::milliseconds getReconnectDelay(size_t worker) {
+        size_t exponent = std::min<size_t>(reconnectAttempts[worker], 20);
+        uint64_t delay = std::min<uint64_t>(static_cast<uint64_t>(reconnectMin.count()) << exponent, reconnectMax.count());
+        std::uniform_int_distribution<uint64_t> jitter(0, delay / 2);
+        return std::chrono::milliseconds(delay - delay / 2 + jitter(randoms[worker]));
+    }
+
+    void scheduleReconnect(size_t worker, const std::string& message) {
+        auto delay = getReconnectDelay(worker);
+        reconnectAttempts[worker]++;
+        nextAttempts[worker] = std::chrono::steady_clock::now() + delay;
+        setState(worker, ConnectionState::Backoff);
+        setLastError(message);
+        log::logger->warn("Worker '{}' retries connecting in '{}' ms, attempt '{}'. {}", worker, delay.count(), reconnectAttempts[worker], message);
+    }
+
+    // Opens a fresh session, the old one and its prepared statements are discarded.
+    void connectSession(size_t worker) {
+        setState(worker, ConnectionState::Connecting);
+        try {
+            rowSink->connect(worker);
+            dictionary::load(worker, *rowSink);
+        }
+        catch (Poco::Exception& e) {
+            // Every failed attempt schedules another one, so an outage shows in the stats while the backoff runs.
+            stats::countError();
+            stats::countReconnect();
+            scheduleReconnect(worker, fmt::format("Failed to connect to {}! Error code: '{}', Error message: {}", rowSink->describe(), e.code(), e.displayText()));
+            return;
         }
-        return number;
+        reconnectAttempts[worker] = 0;
+        setState(worker, ConnectionState::Connected);
+        log::logger->info("Worker '{}' connected to {}.", worker, rowSink->describe());
     }
 
-    Poco::Nullable<double> getNumericValue(const std::vector<std::string>& parameters, const size_t& idx) {
-        if (parameters.size() > idx && !parameters[idx].empty()) {
-            double number = 0;
-            if (!Poco::NumberParser::tryParseFloat(parameters[idx], number)) {
-                return Poco::Nullable<double>();
+    // Returns false if the extension stops before the worker could connect.
+    bool awaitConnection(size_t worker) {
+        while (workerStates[worker] != ConnectionState::Connected) {
+            if (stopping) { return false; }
+            auto now = std::chrono::steady_clock::now();
+            if (now < nextAttempts[worker]) {
+                std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(nextAttempts[worker] - now, STOP_CHECK_INTERVAL));
+                continue;
             }
-            return Poco::Nullable<double>(number);
+            connectSession(worker);
         }
-        return Poco::Nullable<double>();
+        return true;
+    }
+
+    bool isRowRequest(const Request& request) {
+        return request.command == Command::Player || request.command == Command::Event ||
+            request.command == Command::InsertReplay || request.command == Command::TouchPlayers;
     }
 
-    Poco::Nullable<std::string> getCharValue(const std::vector<std::string>& parameters, const size_t& idx) {
-        if (parameters.size() > idx && !parameters[idx].empty()) {
-            return Poco::Nullable<std::string>(parameters[idx]);
+    // A deferred player or event carries everything after the command as param 1. Splitting
+    // a param that holds no separator gives the param back, so this is also safe for
+    // requests that were split by call() and for journaled requests.
+    void expandDeferred(Request& request, Request& expanded, std::vector<StringRef>& tokens) {
+        if ((request.command != Command::Player && request.command != Command::Event) || request.size() != 2) { return; }
+        StringRef remainder = request.param(1);
+        tokenizer::split(remainder.data, remainder.size, tokens);
+        expanded.clear();
+        expanded.command = request.command;
+        expanded.ticket = request.ticket;
+        expanded.enqueued = request.enqueued;
+        expanded.traceId = request.traceId;
+        expanded.journalRecord = request.journalRecord;
+        expanded.coalescedRecords.swap(request.coalescedRecords);
+        expanded.add(request.param(0));
+        for (auto& token : tokens) {
+            expanded.add(token);
         }
-        return Poco::Nullable<std::string>();
+        std::swap(request, expanded);
+    }
+
+    bool isLowOnReplayIds() {
+        std::lock_guard<std::mutex> lock(replayIdsMutex);
+        return replayIdBlock > 0 && availableReplayIds <= replayIdBlock / 2;
     }
 
-    bool initialize(const std::string& host_, uint32_t port_, const std::string& database_, const std::string& user_, const std::string& password_, size_t timeout_) {
-        host = host_;
-        port = port_;
-        database = database_;
-        user = user_;
-        password = password_;
-        timeout = timeout_;
+    bool reserveReplayIds(size_t worker) {
+        uint32_t nextId = 0;
+        try {
+            nextId = rowSink->reserveReplayIds(worker, replayIdBlock);
+            if (nextId == 0) {
+                log::logger->error("Table 'replayIds' has no row, cannot reserve replay ids!");
+                return false;
+            }
+        }
+        catch (Poco::Data::DataException& e) {
+            log::logger->error("Error reserving replay ids! Error code: '{}', Error message: {}", e.code(), e.displayText());
+            invalidateStatements(worker, e);
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(replayIdsMutex);
+        replayIds.emplace_back(nextId - replayIdBlock, nextId);
+        availableReplayIds += replayIdBlock;
+        R3_LOG_DEBUG("Worker '{}' reserved replay ids '{}' to '{}'.", worker, nextId - replayIdBlock, nextId - 1);
         return true;
     }
 
-    void finalize() {
-        delete session;
-        Poco::Data::MySQL::Connector::unregisterConnector();
+    // Only one worker refills at a time, after a failure the next attempt waits RESERVE_RETRY_INTERVAL.
+    void refillReplayIds(size_t worker) {
+        if (!isLowOnReplayIds() || reservingReplayIds.exchange(true)) { return; }
+        if (std::chrono::steady_clock::now() >= nextReserve && !reserveReplayIds(worker)) {
+            nextReserve = std::chrono::steady_clock::now() + RESERVE_RETRY_INTERVAL;
+        }
+        reservingReplayIds = false;
+    }
+
+    void recordCommit(const std::vector<Request>& batch, size_t rows) {
+        uint64_t committed = stats::now();
+        for (auto& request : batch) {
+            stats::recordLatency(committed - request.enqueued);
+        }
+        stats::countRows(rows);
+    }
+
+    // Staged events are already on disk and are loaded from there.
+    bool isUnwritten(const Request& request, bool eventsStaged) {
+        return isRowRequest(request) && !(eventsStaged && request.command == Command::Event);
     }
 
-    void run() {
-        auto request = extension::popRequest();
-        while (request.command != REQUEST_COMMAND_POISON) {
-            {
-                std::lock_guard<std::mutex> lock(sessionMutex);
-                processRequest(request);
+    // A request read from the journal that could not be journaled again keeps its record, so it is read again on the next start.
+    size_t persistBatch(std::vector<Request>& batch, bool eventsStaged) {
+        size_t persisted = 0;
+        for (auto& request : batch) {
+            if (!isUnwritten(request, eventsStaged)) { continue; }
+            if (journal::append(request)) {
+                persisted++;
+            }
+            else {
+                request.keepJournalRecords();
             }
-            request = extension::popRequest();
         }
+        return persisted;
     }
 
-    std::mutex& getSessionMutex() {
-        return sessionMutex;
+    // The first sampled request of the batch names the batch spans, the queue span of each sampled request ends here.
+    uint32_t getTraceId(const std::vector<Request>& batch) {
+        if (!trace::isEnabled()) { return 0; }
+        uint32_t traceId = 0;
+        uint64_t dequeued = trace::now();
+        for (auto& request : batch) {
+            if (request.traceId == 0) { continue; }
+            trace::end("queue", request.traceId, dequeued);
+            if (traceId == 0) { traceId = request.traceId; }
+        }
+        return traceId;
     }
 
-    bool isConnected() {
-        return connected;
+    void traceCommitted(const std::vector<Request>& batch) {
+        uint64_t committed = trace::now();
+        for (auto& request : batch) {
+            if (request.traceId != 0) {
+                trace::end("request", request.traceId, committed);
+            }
+        }
     }
 
-    std::string connect() {
-        if (connected) { return ""; }
-        log::logger->info("Connecting to MySQL server at '{}@{}:{}/{}'.", user, host, port, database);
-        connected = false;
-        try {
-            Poco::Data::MySQL::Connector::registerConnector();
-            session = new Poco::Data::Session("MySQL", fmt::format("host={};port={};db={};user={};password={};compress=true;auto-reconnect=true", host, port, database, user, password), timeout);
-            connected = true;
+    // Appends the events to the staging file of worker instead of inserting them, they are loaded once the file is closed.
+    bool stageEvents(size_t worker, std::vector<EventRow>& events) {
+        if (!staging::isEnabled() || staging::isSuspended() || events.empty()) { return false; }
+        if (!staging::append(worker, events)) {
+            log::logger->error("Worker '{}' inserts '{}' events that could not be staged.", worker, events.size());
+            return false;
         }
-        catch (Poco::Data::ConnectionFailedException& e) {
-            std::string message = fmt::format("Failed to connect to MySQL server! Error code: '{}', Error message: {}", e.code(), e.displayText());
-            log::logger->error(message);
-            connected = false;
-            return message;
+        events.clear();
+        return true;
+    }
+
+    // Loads the closed staging files that are due. A file that fails to load is kept and loaded again later,
+    // the open file is closed while staging is suspended so it is retried along with the others.
+    void loadStaged(size_t worker, bool closeOpen) {
+        if (!staging::isEnabled()) { return; }
+        staging::rotate(worker, closeOpen || staging::isSuspended());
+        std::string path;
+        size_t rows = 0;
+        while (staging::take(path, rows)) {
+            uint64_t start = stats::now();
+            try {
+                rowSink->loadEvents(worker, path, rows);
+            }
+            catch (Poco::Data::DataException& e) {
+                std::string message = fmt::format("Error loading '{}' events from staging file '{}'! Error code: '{}', Error message: {}", rows, path, e.code(), e.displayText());
+                log::logger->error(message);
+                setLastError(message);
+                staging::failed(path, rows);
+                invalidateStatements(worker, e);
+                if (isSessionLost(e)) {
+                    scheduleReconnect(worker, fmt::format("Lost database session! Error code: '{}', Error message: {}", e.code(), e.displayText()));
+                }
+                return;
+            }
+            staging::loaded(path);
+            stats::countRows(rows);
+            R3_LOG_DEBUG("Worker '{}' loaded '{}' events from staging file '{}' in '{}' ms.", worker, rows, path, (stats::now() - start) / 1000000);
         }
-        catch (Poco::Data::MySQL::ConnectionException& e) {
-            std::string message = fmt::format("Failed to connect to MySQL server! Error code: '{}', Error message: {}", e.code(), e.displayText());
-            log::logger->error(message);
-            connected = false;
-            return message;
+    }
+
+    // Returns false if the session was lost and the rows of the batch must be written again once the worker reconnects.
+    bool processBatch(size_t worker, std::vector<Request>& batch) {
+        std::vector<ReplayRow> replays;
+        std::vector<PlayerRow> players;
+        std::vector<TouchRow> touches;
+        std::vector<EventRow> events;
+        players.reserve(batch.size());
+        events.reserve(batch.size());
+        Request expanded;
+        std::vector<StringRef> tokens;
+        for (auto& request : batch) {
+            expandDeferred(request, expanded, tokens);
+            if (request.command == Command::InsertReplay) {
+                replays.emplace_back();
+                if (!parseReplay(request, replays.back())) {
+                    replays.pop_back();
+                    log::logger->error("Dropping '{}' request with '{}' params!", commands::get(request.command).name, request.size());
+                    stats::countError();
+                }
+            }
+            else if (request.command == Command::TouchPlayers) {
+                for (size_t i = 1; i < request.size(); i++) {
+                    touches.push_back(TouchRow{ request.str(i) });
+                }
+            }
+            else if (request.command == Command::Player) {
+                players.emplace_back();
+                if (!parsePlayer(request, players.back())) {
+                    players.pop_back();
+                    log::logger->error("Dropping 'player' request with '{}' params!", request.size());
+                    stats::countError();
+                }
+            }
+            else if (request.command == Command::Event) {
+                events.emplace_back();
+                if (!parseEvent(request, events.back())) {
+                    events.pop_back();
+                    log::logger->error("Dropping 'event' request with '{}' params!", request.size());
+                    stats::countError();
+                }
+            }
+            else {
+                Response response = processRequest(worker, request);
+                if (request.ticket != 0) {
+                    extension::setResult(request.ticket, response);
+                }
+            }
         }
-        return "";
+        if (replays.empty() && players.empty() && touches.empty() && events.empty()) { return true; }
+        uint32_t traceId = getTraceId(batch);
+        bool eventsStaged = stageEvents(worker, events);
+        if (replays.empty() && players.empty() && touches.empty() && events.empty()) {
+            recordCommit(batch, 0);
+            if (traceId != 0) {
+                traceCommitted(batch);
+            }
+            return true;
+        }
+        R3_LOG_DEBUG("Worker '{}' writing batch of '{}' replays, '{}' players and '{}' events.", worker, replays.size(), players.size(), events.size());
+        for (int attempt = 0; attempt < 2; attempt++) {
+            try {
+                // New dictionary keys are committed on their own, a rolled back batch must not take them along.
+                dictionary::encode(worker, *rowSink, events);
+                uint64_t begun = traceId != 0 ? trace::now() : 0;
+                rowSink->begin(worker);
+                uint64_t executed = traceId != 0 ? trace::now() : 0;
+                // Replays first, their events may be in the same batch.
+                rowSink->insert(worker, replays);
+                rowSink->insert(worker, players);
+                rowSink->insert(worker, touches);
+                rowSink->insert(worker, events);
+                uint64_t committed = traceId != 0 ? trace::now() : 0;
+                rowSink->commit(worker);
+                recordCommit(batch, replays.size() + players.size() + touches.size() + events.size());
+                if (traceId != 0) {
+                    trace::complete("begin", traceId, begun, executed);
+                    trace::complete("execute", traceId, executed, committed);
+                    trace::complete("commit", traceId, committed, trace::now());
+                    traceCommitted(batch);
+                }
+                return true;
+            }
+            catch (Poco::Data::DataException& e) {
+                try {
+                    rowSink->rollback(worker);
+                }
+                catch (Poco::Data::DataException& rollbackError) {
+                    log::logger->error("Error rolling back batch! Error code: '{}', Error message: {}", rollbackError.code(), rollbackError.displayText());
+                }
+                if (attempt == 0 && isSessionLost(e)) {
+                    invalidateStatements(worker, e);
+                    continue;
+                }
+                if (isSessionLost(e)) {
+                    invalidateStatements(worker, e);
+                    scheduleReconnect(worker, fmt::format("Lost database session! Error code: '{}', Error message: {}", e.code(), e.displayText()));
+                    if (journal::isEnabled()) {
+                        log::logger->error("Worker '{}' lost the database, journaled '{}' requests of the failed batch!", worker, persistBatch(batch, eventsStaged));
+                        return true;
+                    }
+                    batch.erase(std::remove_if(batch.begin(), batch.end(), [eventsStaged](const Request& request) { return !isUnwritten(request, eventsStaged); }), batch.end());
+                    log::logger->error("Worker '{}' lost the database, keeping '{}' requests of the failed batch until it reconnects!", worker, batch.size());
+                    return false;
+                }
+                log::logger->error("Error writing batch of '{}' replays, '{}' players and '{}' events, retrying row by row! Error code: '{}', Error message: {}", replays.size(), players.size(), events.size(), e.code(), e.displayText());
+                invalidateStatements(worker, e);
+                break;
+            }
+        }
+        std::vector<ReplayRow> replay(1);
+        for (auto& row : replays) {
+            replay[0] = row;
+            try {
+                rowSink->insert(worker, replay);
+                stats::countRows(1);
+            }
+            catch (Poco::Data::DataException& e) {
+                invalidateStatements(worker, e);
+                log::logger->error("Error inserting into 'replays' values id '{}', missionName '{}', map '{}', dayTime '{}', addonVersion '{}'! Error code: '{}', Error message: {}", row.id, row.missionName, row.map, row.dayTime, row.addonVersion, e.code(), e.displayText());
+            }
+        }
+        std::vector<PlayerRow> player(1);
+        for (auto& row : players) {
+            player[0] = row;
+            try {
+                rowSink->insert(worker, player);
+                stats::countRows(1);
+            }
+            catch (Poco::Data::DataException& e) {
+                invalidateStatements(worker, e);
+                log::logger->error("Error inserting into 'players' values id '{}', name '{}'! Error code: '{}', Error message: {}", row.id, row.name, e.code(), e.displayText());
+            }
+        }
+        std::vector<TouchRow> touch(1);
+        for (auto& row : touches) {
+            touch[0] = row;
+            try {
+                rowSink->insert(worker, touch);
+                stats::countRows(1);
+            }
+            catch (Poco::Data::DataException& e) {
+                invalidateStatements(worker, e);
+                log::logger->error("Error updating lastSeen of player id '{}'! Error code: '{}', Error message: {}", row.id, e.code(), e.displayText());
+            }
+        }
+        std::vector<EventRow> event(1);
+        for (auto& row : events) {
+            event[0] = row;
+            try {
+                dictionary::encode(worker, *rowSink, event);
+                rowSink->insert(worker, event);
+                stats::countRows(1);
+            }
+            catch (Poco::Data::DataException& e) {
+                invalidateStatements(worker, e);
+                log::logger->error("Error inserting into 'events' values replayId '{}', playerId '{}', type '{}', value '{}', missionTime '{}'! Error code: '{}', Error message: {}", row.replayId, row.playerId, row.type, row.value, row.missionTime, e.code(), e.displayText());
+            }
+        }
+        return true;
+    }
+
+    bool initialize(std::unique_ptr<sink::Sink> sink_, size_t batchSize_, size_t batchLinger_, size_t poolSize_, size_t reconnectMin_, size_t reconnectMax_, size_t replayIdBlock_, bool dictionary_) {
+        rowSink = std::move(sink_);
+        batchSize = std::max<size_t>(batchSize_, 1);
+        batchLinger = std::chrono::milliseconds(batchLinger_);
+        poolSize = std::max<size_t>(poolSize_, 1);
+        reconnectMin = std::chrono::milliseconds(std::max<size_t>(reconnectMin_, 1));
+        reconnectMax = std::chrono::milliseconds(std::max(reconnectMax_, reconnectMin_));
+        replayIdBlock = static_cast<uint32_t>(replayIdBlock_);
+        if (dictionary_) {
+            dictionary::initialize(poolSize);
+        }
+        rowSink->initialize(poolSize, batchSize, dictionary::isEnabled());
+        workerStates.assign(poolSize, ConnectionState::Disconnected);
+        reconnectAttempts.assign(poolSize, 0);
+        nextAttempts.assign(poolSize, std::chrono::steady_clock::time_point());
+        runningWorkers.reset(new std::atomic<bool>[poolSize]);
+        for (size_t worker = 0; worker < poolSize; worker++) {
+            runningWorkers[worker] = false;
+        }
+        std::random_device seed;
+        for (size_t worker = 0; worker < poolSize; worker++) {
+            randoms.emplace_back(seed());
+        }
+        return true;
+    }
+
+    void finalize() {
+        if (rowSink) {
+            rowSink->finalize();
+            rowSink.reset();
+        }
+        dictionary::finalize();
+        workerStates.clear();
+        runningWorkers.reset();
+        randoms.clear();
+        replayIds.clear();
+        availableReplayIds = 0;
+        connectedWorkers = 0;
+        backoffWorkers = 0;
+        started = false;
+        stopping = false;
+    }
+
+    size_t getPoolSize() {
+        return poolSize;
+    }
+
+    sink::Sink& getSink() {
+        return *rowSink;
     }
 
-    Response processRequest(const Request& request) {
+    // Requests stay in the queue while the worker is not connected, a batch that failed
+    // with a lost session is kept and written again after reconnecting.
+    void run(size_t worker) {
+        trace::setThreadName(fmt::format("writer {}", worker));
+        std::vector<Request> batch;
+        batch.reserve(batchSize);
+        bool poisoned = false;
+        while (!poisoned || !batch.empty()) {
+            if (!awaitConnection(worker)) {
+                log::logger->warn("Worker '{}' stopped without a database connection, '{}' requests were not written!", worker, batch.size() + coalesce::pending(worker));
+                break;
+            }
+            refillReplayIds(worker);
+            loadStaged(worker, false);
+            if (batch.empty()) {
+                Request first;
+                auto idleInterval = coalesce::isEnabled() ? std::min(IDLE_INTERVAL, coalesce::getWindow()) : IDLE_INTERVAL;
+                if (extension::popRequest(worker, first, idleInterval)) {
+                    batch.push_back(std::move(first));
+                    auto deadline = std::chrono::steady_clock::now() + batchLinger;
+                    while (batch.back().command != Command::Poison && batch.size() < batchSize) {
+                        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                        Request request;
+                        if (!extension::popRequest(worker, request, std::max(remaining, std::chrono::milliseconds::zero()))) { break; }
+                        batch.push_back(std::move(request));
+                    }
+                    if (batch.back().command == Command::Poison) {
+                        poisoned = true;
+                        batch.pop_back();
+                    }
+                }
+                // Held back events are written once their window ends, and all of them on shutdown.
+                coalesce::process(worker, batch, poisoned);
+                if (batch.empty()) { continue; }
+            }
+            if (processBatch(worker, batch)) {
+                extension::recycle(batch);
+            }
+        }
+        // Staging files that still fail to load are loaded on the next start.
+        if (workerStates[worker] == ConnectionState::Connected) {
+            loadStaged(worker, true);
+        }
+        setState(worker, ConnectionState::Disconnected);
+        runningWorkers[worker] = false;
+    }
+
+    void start() {
+        if (started) { return; }
+        log::logger->info("Connecting '{}' sessions to {}.", poolSize, rowSink->describe());
+        rowSink->start();
+        for (size_t worker = 0; worker < poolSize; worker++) {
+            runningWorkers[worker] = true;
+        }
+        started = true;
+    }
+
+    // Lets workers that are waiting for a connection exit, connected workers still write their queue up to the poison request.
+    void stop() {
+        stopping = true;
+    }
+
+    bool isRunning(size_t worker) {
+        return runningWorkers[worker];
+    }
+
+    bool isStarted() {
+        return started;
+    }
+
+    bool isAvailable() {
+        return started && connectedWorkers == poolSize;
+    }
+
+    std::string getState() {
+        if (!started) { return "disconnected"; }
+        if (connectedWorkers == poolSize) { return "connected"; }
+        if (backoffWorkers > 0) { return "backoff"; }
+        return "connecting";
+    }
+
+    size_t getConnectedWorkers() {
+        return connectedWorkers;
+    }
+
+    std::string getLastError() {
+        std::lock_guard<std::mutex> lock(lastErrorMutex);
+        return lastError;
+    }
+
+    bool takeReplayId(uint32_t& id) {
+        std::lock_guard<std::mutex> lock(replayIdsMutex);
+        if (replayIds.empty()) { return false; }
+        auto& block = replayIds.front();
+        id = block.first++;
+        if (block.first == block.second) {
+            replayIds.pop_front();
+        }
+        availableReplayIds--;
+        return true;
+    }
+
+    Response processRequest(size_t worker, const Request& request) {
         Response response{ RESPONSE_TYPE_OK, EMPTY_SQF_DATA };
-        auto realParamsSize = request.params.size() - 1;
-        log::logger->trace("Request command '{}' params size '{}'!", request.command, request.params.size());
+        commands::Value values[commands::MAX_PARAMS];
+        R3_LOG_TRACE("Request command '{}' params size '{}'!", commands::get(request.command).name, request.size());
+        if (!commands::decode(request, values)) {
+            R3_LOG_DEBUG("Invlaid command type '{}'!", commands::get(request.command).name);
+            response.type = RESPONSE_TYPE_ERROR;
+            response.data = fmt::format("\"Invalid command type!\"");
+            return response;
+        }
         try {
-            if (request.command == "replay" && realParamsSize == 4) {
-                std::string missionName = request.params[1];
-                std::string map = request.params[2];
-                double dayTime = getNumericValue(request.params, 3);
-                std::string addonVersion = request.params[4];
-                log::logger->debug("Inserting into 'replays' values missionName '{}', map '{}', dayTime '{}', addonVersion '{}'.", missionName, map, dayTime, addonVersion);
-                *session << "INSERT INTO replays(missionName, map, dayTime, dateStarted, addonVersion) VALUES(?, ?, ?, NOW(), ?)",
-                    Poco::Data::Keywords::use(missionName),
-                    Poco::Data::Keywords::use(map),
-                    Poco::Data::Keywords::use(dayTime),
-                    Poco::Data::Keywords::use(addonVersion),
-                    Poco::Data::Keywords::now;
-                uint32_t replayId = 0;
-                *session << "SELECT LAST_INSERT_ID()",
-                    Poco::Data::Keywords::into(replayId),
-                    Poco::Data::Keywords::now;
-                log::logger->debug("New replay id is '{}'.", replayId);
-                response.data = std::to_string(replayId);
-            }
-            else if (request.command == "player" && realParamsSize == 2) {
-                std::string id = request.params[1];
-                std::string name = request.params[2];
-                log::logger->debug("Inserting into 'players' values id '{}', name '{}'.", id, name);
-                *session << "INSERT INTO players(id, name, lastSeen) VALUES (?, ?, NOW()) ON DUPLICATE KEY UPDATE lastSeen = NOW()",
-                    Poco::Data::Keywords::use(id),
-                    Poco::Data::Keywords::use(name),
-                    Poco::Data::Keywords::now;
-            }
-            else if (request.command == "event" && realParamsSize == 5) {
-                uint32_t replayId = parseUnsigned(request.params[1]);
-                std::string playerId = request.params[2];
-                std::string type = request.params[3];
-                std::string value = request.params[4];
-                double missionTime = parseFloat(request.params[5]);
-                log::logger->debug("Inserting into 'events' values replayId '{}', playerId '{}', type '{}', value '{}', missionTime '{}'.", replayId, playerId, type, value, missionTime);
-                *session << "INSERT INTO events(replayId, playerId, type, value, missionTime, added) VALUES (?, ?, ?, ?, ?, NOW())",
-                    Poco::Data::Keywords::use(replayId),
-                    Poco::Data::Keywords::use(playerId),
-                    Poco::Data::Keywords::use(type),
-                    Poco::Data::Keywords::use(value),
-                    Poco::Data::Keywords::use(missionTime),
-                    Poco::Data::Keywords::now;
+            switch (request.command) {
+            case Command::Replay:
+                if (replayIdBlock > 0) {
+                    // Also take the id from a block here, an auto increment id could collide with a reserved one.
+                    std::vector<ReplayRow> rows(1);
+                    Request replay = request;
+                    uint32_t replayId = 0;
+                    if (!takeReplayId(replayId) && !(reserveReplayIds(worker) && takeReplayId(replayId))) {
+                        response.type = RESPONSE_TYPE_ERROR;
+                        response.data = "\"Could not reserve a replay id!\"";
+                        return response;
+                    }
+                    replay.command = Command::InsertReplay;
+                    replay.add(std::to_string(replayId));
+                    parseReplay(replay, rows[0]);
+                    R3_LOG_DEBUG("Inserting into 'replays' values id '{}', missionName '{}', map '{}', dayTime '{}', addonVersion '{}'.", rows[0].id, rows[0].missionName, rows[0].map, rows[0].dayTime, rows[0].addonVersion);
+                    rowSink->insert(worker, rows);
+                    response.data = std::to_string(replayId);
+                }
+                else {
+                    ReplayRow replay{ 0, values[0].text.str(), values[1].text.str(), values[2].number, values[3].text.str() };
+                    R3_LOG_DEBUG("Inserting into 'replays' values missionName '{}', map '{}', dayTime '{}', addonVersion '{}'.", replay.missionName, replay.map, replay.dayTime, replay.addonVersion);
+                    uint32_t replayId = rowSink->insertReplay(worker, replay);
+                    R3_LOG_DEBUG("New replay id is '{}'.", replayId);
+                    response.data = std::to_string(replayId);
+                }
+                break;
+            case Command::Player: {
+                std::vector<PlayerRow> rows(1);
+                parsePlayer(request, rows[0]);
+                R3_LOG_DEBUG("Inserting into 'players' values id '{}', name '{}'.", rows[0].id, rows[0].name);
+                rowSink->insert(worker, rows);
+                break;
             }
-            else {
-                log::logger->debug("Invlaid command type '{}'!", request.command);
+            case Command::Event: {
+                std::vector<EventRow> rows(1);
+                parseEvent(request, rows[0]);
+                dictionary::encode(worker, *rowSink, rows);
+                R3_LOG_DEBUG("Inserting into 'events' values replayId '{}', playerId '{}', type '{}', value '{}', missionTime '{}'.", rows[0].replayId, rows[0].playerId, rows[0].type, rows[0].value, rows[0].missionTime);
+                rowSink->insert(worker, rows);
+                break;
+            }
+            default:
+                R3_LOG_DEBUG("Invlaid command type '{}'!", commands::get(request.command).name);
                 response.type = RESPONSE_TYPE_ERROR;
                 response.data = fmt::format("\"Invalid command type!\"");
             }
         }
-        catch (Poco::Data::MySQL::MySQLException& e) {
+        catch (Poco::Data::DataException& e) {
             log::logger->error("Error executing prepared statement! Error code: '{}', Error message: {}", e.code(), e.displayText());
+            invalidateStatements(worker, e);
             response.type = RESPONSE_TYPE_ERROR;
             response.data = fmt::format("\"Error executing prepared statement! {}\"", e.displayText());
         }
@@ -0,0 +1,290 @@
+#include "staging.h"
+
+#include "log.h"
+
+#include "Poco/Exception.h"
+#include "Poco/File.h"
+#include "Poco/NumberParser.h"
+#include "Poco/Path.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+
+
+namespace r3 {
+namespace staging {
+
+namespace {
+    const std::string FILE_PREFIX = "events_";
+    const std::string FILE_EXTENSION = ".tsv";
+    // Appended once the rows of a file are in the database, the file is never loaded again.
+    const std::string LOADED_EXTENSION = ".loaded";
+    const std::chrono::seconds RETRY_INTERVAL(10);
+    // Loads failing in a row before new rows are inserted instead of staged.
+    const size_t MAX_FAILURES = 3;
+
+    struct OpenFile {
+        std::string path;
+        std::ofstream stream;
+        size_t size;
+        size_t rows;
+        std::chrono::steady_clock::time_point opened;
+    };
+
+    struct ClosedFile {
+        std::string path;
+        size_t rows;
+        std::chrono::steady_clock::time_point due;
+    };
+
+    bool enabled = false;
+    std::string folder;
+    size_t maxSize;
+    std::chrono::milliseconds interval;
+    // Owned by the writer of the same index.
+    std::vector<std::unique_ptr<OpenFile>> openFiles;
+    std::vector<std::string> buffers;
+    std::atomic<uint64_t> nextSequence(0);
+    std::mutex closedMutex;
+    std::deque<ClosedFile> closedFiles;
+    std::atomic<size_t> failures(0);
+    std::atomic<bool> suspended(false);
+}
+
+    std::string getPath(uint64_t sequence) {
+        return fmt::format("{}{}{}{:010}{}", folder, Poco::Path::separator(), FILE_PREFIX, sequence, FILE_EXTENSION);
+    }
+
+    // Parses the sequence of a staging file name ending in extension.
+    bool parseSequence(const std::string& file, const std::string& extension, uint64_t& sequence) {
+        return file.size() > FILE_PREFIX.size() + extension.size() &&
+            file.compare(0, FILE_PREFIX.size(), FILE_PREFIX) == 0 &&
+            file.compare(file.size() - extension.size(), extension.size(), extension) == 0 &&
+            Poco::NumberParser::tryParseUnsigned64(file.substr(FILE_PREFIX.size(), file.size() - FILE_PREFIX.size() - extension.size()), sequence);
+    }
+
+    // Matches LOAD DATA ... FIELDS TERMINATED BY '\t' ESCAPED BY '\\' LINES TERMINATED BY '\n'.
+    void escape(std::string& line, const std::string& value) {
+        for (char c : value) {
+            switch (c) {
+            case '\\': line += "\\\\"; break;
+            case '\t': line += "\\t"; break;
+            case '\n': line += "\\n"; break;
+            case '\r': line += "\\r"; break;
+            case '\0': line += "\\0"; break;
+            default: line += c;
+            }
+        }
+    }
+
+    void close(OpenFile& file) {
+        file.stream.close();
+        std::lock_guard<std::mutex> lock(closedMutex);
+        closedFiles.push_back(ClosedFile{ file.path, file.rows, std::chrono::steady_clock::now() });
+        R3_LOG_DEBUG("Closed staging file '{}' with '{}' rows.", file.path, file.rows);
+    }
+
+    // Counts the complete rows of a file left from an earlier run, a row torn by a crash is cut off.
+    size_t recover(const std::string& path) {
+        std::ifstream stream(path, std::ios::binary);
+        std::string content((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+        size_t complete = content.rfind('\n');
+        complete = complete == std::string::npos ? 0 : complete + 1;
+        if (complete < content.size()) {
+            log::logger->warn("Cutting '{}' bytes of a torn row from staging file '{}'.", content.size() - complete, path);
+            Poco::File(path).setSize(complete);
+        }
+        return std::count(content.begin(), content.begin() + complete, '\n');
+    }
+
+    bool initialize(const std::string& folder_, size_t workers, size_t maxSize_, const std::chrono::milliseconds& interval_) {
+        folder = folder_;
+        maxSize = maxSize_;
+        interval = interval_;
+        size_t recoveredRows = 0;
+        try {
+            Poco::File(folder).createDirectories();
+            std::vector<std::string> files;
+            Poco::File(folder).list(files);
+            std::sort(files.begin(), files.end());
+            for (auto& file : files) {
+                uint64_t sequence = 0;
+                if (parseSequence(file, FILE_EXTENSION + LOADED_EXTENSION, sequence)) {
+                    // Loaded before the last shutdown, only its removal was missed.
+                    nextSequence = std::max<uint64_t>(nextSequence, sequence + 1);
+                    Poco::File(getPath(sequence) + LOADED_EXTENSION).remove();
+                    continue;
+                }
+                if (!parseSequence(file, FILE_EXTENSION, sequence)) { continue; }
+                nextSequence = std::max<uint64_t>(nextSequence, sequence + 1);
+                std::string path = getPath(sequence);
+                size_t rows = recover(path);
+                if (rows == 0) {
+                    Poco::File(path).remove();
+                    continue;
+                }
+                closedFiles.push_back(ClosedFile{ path, rows, std::chrono::steady_clock::now() });
+                recoveredRows += rows;
+            }
+        }
+        catch (Poco::Exception& e) {
+            log::logger->error("Failed to open staging folder '{}'! Error message: {}", folder, e.displayText());
+            closedFiles.clear();
+            return false;
+        }
+        for (size_t worker = 0; worker < workers; worker++) {
+            openFiles.emplace_back(new OpenFile());
+        }
+        buffers.resize(workers);
+        enabled = true;
+        log::logger->info("Staging events in '{}', '{}' rows in '{}' files are left to load.", folder, recoveredRows, closedFiles.size());
+        return true;
+    }
+
+    // Files still open or not loaded stay in the folder and are loaded on the next start.
+    void finalize() {
+        if (!enabled) { return; }
+        for (auto& file : openFiles) {
+            if (file->stream.is_open()) {
+                close(*file);
+            }
+        }
+        if (!closedFiles.empty()) {
+            log::logger->warn("Left '{}' staging files to load on the next start.", closedFiles.size());
+        }
+        openFiles.clear();
+        buffers.clear();
+        closedFiles.clear();
+        failures = 0;
+        suspended = false;
+        enabled = false;
+    }
+
+    bool isEnabled() {
+        return enabled;
+    }
+
+    bool isSuspended() {
+        return suspended;
+    }
+
+    bool append(size_t worker, const std::vector<sink::EventRow>& rows) {
+        OpenFile& file = *openFiles[worker];
+        std::string& buffer = buffers[worker];
+        buffer.clear();
+        for (auto& row : rows) {
+            buffer += fmt::format("{}\t", row.replayId);
+            escape(buffer, row.playerId);
+            buffer += '\t';
+            escape(buffer, row.type);
+            buffer += '\t';
+            escape(buffer, row.value);
+            buffer += fmt::format("\t{:.17g}\n", row.missionTime);
+        }
+        if (!file.stream.is_open()) {
+            file.path = getPath(nextSequence++);
+            file.stream.open(file.path, std::ios::binary | std::ios::trunc);
+            file.size = 0;
+            file.rows = 0;
+            file.opened = std::chrono::steady_clock::now();
+            if (!file.stream) {
+                log::logger->error("Failed to open staging file '{}'!", file.path);
+                file.stream.close();
+                return false;
+            }
+        }
+        file.stream.write(buffer.data(), buffer.size());
+        file.stream.flush();
+        if (!file.stream) {
+            // Cut the partly written rows, the rows before them are still loaded.
+            log::logger->error("Failed to write '{}' rows to staging file '{}'!", rows.size(), file.path);
+            file.stream.close();
+            try {
+                if (file.rows == 0) {
+                    Poco::File(file.path).remove();
+                    return false;
+                }
+                Poco::File(file.path).setSize(file.size);
+            }
+            catch (Poco::Exception& e) {
+                log::logger->error("Failed to cut staging file '{}'! Error message: {}", file.path, e.displayText());
+            }
+            std::lock_guard<std::mutex> lock(closedMutex);
+            closedFiles.push_back(ClosedFile{ file.path, file.rows, std::chrono::steady_clock::now() });
+            return false;
+        }
+        file.size += buffer.size();
+        file.rows += rows.size();
+        return true;
+    }
+
+    void rotate(size_t worker, bool force) {
+        OpenFile& file = *openFiles[worker];
+        if (!file.stream.is_open()) { return; }
+        if (force || file.size >= maxSize || std::chrono::steady_clock::now() - file.opened >= interval) {
+            close(file);
+        }
+    }
+
+    bool take(std::string& path, size_t& rows) {
+        std::lock_guard<std::mutex> lock(closedMutex);
+        auto now = std::chrono::steady_clock::now();
+        auto due = std::find_if(closedFiles.begin(), closedFiles.end(), [&now](const ClosedFile& file) { return file.due <= now; });
+        if (due == closedFiles.end()) { return false; }
+        path = due->path;
+        rows = due->rows;
+        closedFiles.erase(due);
+        return true;
+    }
+
+    void loaded(const std::string& path) {
+        failures = 0;
+        if (suspended.exchange(false)) {
+            log::logger->info("Staging file '{}' loaded, staging events again.", path);
+        }
+        // Marked first, so a file that is not removed is skipped on the next start instead of loaded twice.
+        Poco::File file(path);
+        try {
+            file.renameTo(path + LOADED_EXTENSION);
+        }
+        catch (Poco::Exception& e) {
+            // An empty file is dropped on the next start as well.
+            try {
+                file.setSize(0);
+            }
+            catch (Poco::Exception& inner) {
+                log::logger->error("Failed to mark loaded staging file '{}', its rows will be loaded again on the next start! Error message: {}", path, inner.displayText());
+                return;
+            }
+            log::logger->warn("Failed to mark loaded staging file '{}', emptied it instead. Error message: {}", path, e.displayText());
+        }
+        try {
+            file.remove();
+        }
+        catch (Poco::Exception& e) {
+            log::logger->warn("Failed to remove loaded staging file '{}', it is removed on the next start. Error message: {}", file.path(), e.displayText());
+        }
+    }
+
+    bool failed(const std::string& path, size_t rows) {
+        {
+            std::lock_guard<std::mutex> lock(closedMutex);
+            closedFiles.push_back(ClosedFile{ path, rows, std::chrono::steady_clock::now() + RETRY_INTERVAL });
+        }
+        if (++failures < MAX_FAILURES || suspended.exchange(true)) { return false; }
+        log::logger->error("Loading staging files failed '{}' times in a row, inserting events until a staged file loads again.", MAX_FAILURES);
+        return true;
+    }
+
+    size_t pending() {
+        std::lock_guard<std::mutex> lock(closedMutex);
+        return closedFiles.size();
+    }
+
+} // namespace staging
+} // namespace r3
@@ -0,0 +1,172 @@
+#include "stats.h"
+
+#include "log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+
+namespace r3 {
+namespace stats {
+
+namespace {
+    const std::string COMMAND_NAMES[COMMAND_COUNT] = { "replay", "player", "event" };
+
+    // Log-linear histogram of nanosecond values: exact below 16, above that 8 buckets
+    // per power of two, which keeps the error of a reported percentile below 12.5%.
+    class Histogram {
+    public:
+        static const size_t LINEAR_BUCKETS = 16;
+        static const size_t SUB_BUCKET_BITS = 3;
+        static const size_t BUCKETS = LINEAR_BUCKETS + (64 - 4) * (1 << SUB_BUCKET_BITS);
+
+        Histogram() : max_(0) {
+            for (auto& bucket : buckets_) { bucket.store(0, std::memory_order_relaxed); }
+        }
+
+        void record(uint64_t value) {
+            buckets_[getBucket(value)].fetch_add(1, std::memory_order_relaxed);
+            uint64_t max = max_.load(std::memory_order_relaxed);
+            while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+        }
+
+        // Reads and resets the histogram, percentiles are reported as the upper bound of their bucket.
+        void collect(uint64_t& p50, uint64_t& p99, uint64_t& max) {
+            uint64_t counts[BUCKETS];
+            uint64_t total = 0;
+            for (size_t i = 0; i < BUCKETS; i++) {
+                counts[i] = buckets_[i].exchange(0, std::memory_order_relaxed);
+                total += counts[i];
+            }
+            max = max_.exchange(0, std::memory_order_relaxed);
+            p50 = std::min(getPercentile(counts, total, 0.50), max);
+            p99 = std::min(getPercentile(counts, total, 0.99), max);
+        }
+
+    private:
+        static size_t getBucket(uint64_t value) {
+            if (value < LINEAR_BUCKETS) { return static_cast<size_t>(value); }
+            size_t exponent = 4;
+            while (exponent < 63 && (value >> (exponent + 1)) != 0) { exponent++; }
+            size_t subBucket = (value >> (exponent - SUB_BUCKET_BITS)) & ((1 << SUB_BUCKET_BITS) - 1);
+            return LINEAR_BUCKETS + (exponent - 4) * (1 << SUB_BUCKET_BITS) + subBucket;
+        }
+
+        static uint64_t getUpperBound(size_t bucket) {
+            if (bucket < LINEAR_BUCKETS) { return bucket; }
+            size_t exponent = 4 + (bucket - LINEAR_BUCKETS) / (1 << SUB_BUCKET_BITS);
+            uint64_t subBucket = (bucket - LINEAR_BUCKETS) % (1 << SUB_BUCKET_BITS);
+            return (((1 << SUB_BUCKET_BITS) + subBucket + 1) << (exponent - SUB_BUCKET_BITS)) - 1;
+        }
+
+        static uint64_t getPercentile(const uint64_t* counts, uint64_t total, double percentile) {
+            if (total == 0) { return 0; }
+            uint64_t rank = static_cast<uint64_t>(percentile * (total - 1)) + 1;
+            uint64_t seen = 0;
+            for (size_t i = 0; i < BUCKETS; i++) {
+                seen += counts[i];
+                if (seen >= rank) { return getUpperBound(i); }
+            }
+            return getUpperBound(BUCKETS - 1);
+        }
+
+        std::atomic<uint64_t> buckets_[BUCKETS];
+        std::atomic<uint64_t> max_;
+    };
+
+    std::atomic<uint64_t> requests[COMMAND_COUNT];
+    std::atomic<uint64_t> rows(0);
+    std::atomic<uint64_t> errors(0);
+    std::atomic<uint64_t> reconnects(0);
+    std::atomic<uint64_t> recentLatency(0);
+    std::atomic<uint64_t> prioritized(0);
+    std::atomic<uint64_t> shed(0);
+    Histogram callTimes;
+    Histogram latencies;
+
+    // Only touched by the stats command on the game thread.
+    uint64_t lastFormat = 0;
+    uint64_t lastRequests[COMMAND_COUNT] = {};
+    uint64_t lastRows = 0;
+}
+
+    uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void countRequest(Command command) {
+        requests[command].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void countRows(size_t count) {
+        rows.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    void countError() {
+        errors.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void countReconnect() {
+        reconnects.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void recordCallTime(uint64_t nanoseconds) {
+        callTimes.record(nanoseconds);
+    }
+
+    void recordLatency(uint64_t nanoseconds) {
+        latencies.record(nanoseconds);
+        recentLatency.store(nanoseconds, std::memory_order_relaxed);
+    }
+
+    uint64_t getRecentLatency() {
+        return recentLatency.load(std::memory_order_relaxed);
+    }
+
+    void countPrioritized() {
+        prioritized.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void countShed() {
+        shed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t getShed() {
+        return shed.load(std::memory_order_relaxed);
+    }
+
+    // Rates, percentiles and maximums cover the time since the previous call, counts are totals.
+    std::string format(size_t depth, size_t highWater, uint64_t journaled, uint64_t dropped) {
+        uint64_t current = now();
+        double seconds = lastFormat == 0 ? 0 : (current - lastFormat) / 1e9;
+        lastFormat = current;
+
+        std::string requestRates;
+        for (size_t i = 0; i < COMMAND_COUNT; i++) {
+            uint64_t count = requests[i].load(std::memory_order_relaxed);
+            double rate = seconds > 0 ? (count - lastRequests[i]) / seconds : 0;
+            lastRequests[i] = count;
+            requestRates += fmt::format("{}[\"{}\",{:.1f}]", i == 0 ? "" : ",", COMMAND_NAMES[i], rate);
+        }
+        uint64_t rowCount = rows.load(std::memory_order_relaxed);
+        double rowRate = seconds > 0 ? (rowCount - lastRows) / seconds : 0;
+        lastRows = rowCount;
+
+        uint64_t latencyP50, latencyP99, latencyMax, callP50, callP99, callMax;
+        latencies.collect(latencyP50, latencyP99, latencyMax);
+        callTimes.collect(callP50, callP99, callMax);
+
+        return fmt::format("[[\"depth\",{}],[\"highWater\",{}],[\"journaled\",{}],[\"dropped\",{}],"
+            "[\"requestsPerSecond\",[{}]],[\"rowsPerSecond\",{:.1f}],"
+            "[\"latencyMicros\",[{:.1f},{:.1f},{:.1f}]],[\"callMicros\",[{:.3f},{:.3f},{:.3f}]],"
+            "[\"errors\",{}],[\"reconnects\",{}],[\"prioritized\",{}],[\"shed\",{}]]",
+            depth, highWater, journaled, dropped,
+            requestRates, rowRate,
+            latencyP50 / 1e3, latencyP99 / 1e3, latencyMax / 1e3, callP50 / 1e3, callP99 / 1e3, callMax / 1e3,
+            errors.load(std::memory_order_relaxed), reconnects.load(std::memory_order_relaxed),
+            prioritized.load(std::memory_order_relaxed), shed.load(std::memory_order_relaxed));
+    }
+
+} // namespace stats
+} // namespace r3
@@ -0,0 +1,88 @@
+#include "tokenizer.h"
+
+#include <regex>
+
+
+namespace r3 {
+namespace tokenizer {
+
+namespace {
+    const std::string REGEX_SPECIAL_CHARACTERS = "\\^$.|?*+()[]{}";
+
+    std::string literal;
+    std::regex separatorRegex;
+    bool literalSeparator = true;
+}
+
+    void compile(const std::string& separator) {
+        literal = separator;
+        literalSeparator = !separator.empty() && separator.find_first_of(REGEX_SPECIAL_CHARACTERS) == std::string::npos;
+        if (!literalSeparator) {
+            separatorRegex = std::regex(separator);
+        }
+    }
+
+    bool isLiteral() {
+        return literalSeparator;
+    }
+
+    // Same semantics as std::cregex_token_iterator with submatch -1: empty tokens
+    // between separators are kept, a trailing empty token after a separator is dropped.
+    void splitLiteral(const char* str, size_t length, std::vector<StringRef>& tokens) {
+        const char* end = str + length;
+        const char* separator = literal.data();
+        size_t separatorSize = literal.size();
+        const char* start = str;
+        const char* position = str;
+        while (static_cast<size_t>(end - position) >= separatorSize) {
+            const char* match = static_cast<const char*>(std::memchr(position, separator[0], end - position - separatorSize + 1));
+            if (match == nullptr) { break; }
+            if (std::memcmp(match, separator, separatorSize) == 0) {
+                tokens.emplace_back(start, match - start);
+                start = match + separatorSize;
+                position = start;
+            }
+            else {
+                position = match + 1;
+            }
+        }
+        if (start != end || tokens.empty()) {
+            tokens.emplace_back(start, end - start);
+        }
+    }
+
+    size_t find(const char* str, size_t length) {
+        if (!literalSeparator) { return length; }
+        const char* end = str + length;
+        const char* position = str;
+        while (static_cast<size_t>(end - position) >= literal.size()) {
+            const char* match = static_cast<const char*>(std::memchr(position, literal[0], end - position - literal.size() + 1));
+            if (match == nullptr) { break; }
+            if (std::memcmp(match, literal.data(), literal.size()) == 0) {
+                return match - str;
+            }
+            position = match + 1;
+        }
+        return length;
+    }
+
+    void splitRegex(const char* str, size_t length, std::vector<StringRef>& tokens) {
+        std::cregex_token_iterator it(str, str + length, separatorRegex, -1);
+        std::cregex_token_iterator end;
+        for (; it != end; ++it) {
+            tokens.emplace_back(it->first, it->length());
+        }
+    }
+
+    void split(const char* str, size_t length, std::vector<StringRef>& tokens) {
+        tokens.clear();
+        if (literalSeparator) {
+            splitLiteral(str, length, tokens);
+        }
+        else {
+            splitRegex(str, length, tokens);
+        }
+    }
+
+} // namespace tokenizer
+} // namespace r3
@@ -0,0 +1,210 @@
+#include "trace.h"
+
+#include "log.h"
+
+#include "Poco/DateTimeFormatter.h"
+#include "Poco/Exception.h"
+#include "Poco/File.h"
+#include "Poco/LocalDateTime.h"
+#include "Poco/Path.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace r3 {
+namespace trace {
+
+namespace {
+    const std::string TRACE_FOLDER = "trace";
+    const std::string TRACE_EXTENSION = ".json";
+
+    struct Event {
+        const char* name;
+        char phase;
+        uint32_t id;
+        uint64_t time;
+        uint64_t duration;
+    };
+
+    // Each thread appends to its own buffer, the lock is only contended while the flush thread swaps it out.
+    struct Buffer {
+        uint32_t threadId;
+        std::mutex mutex;
+        std::vector<Event> events;
+        std::string name;
+        bool nameWritten;
+    };
+
+    bool enabled = false;
+    uint32_t sampleRate;
+    uint32_t sampled = 0;
+    uint32_t nextId = 1;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::milliseconds flushInterval;
+    std::string path;
+    std::ofstream file;
+    size_t written = 0;
+
+    std::mutex buffersMutex;
+    std::vector<std::unique_ptr<Buffer>> buffers;
+    thread_local Buffer* threadBuffer = nullptr;
+
+    std::thread flushThread;
+    std::mutex stopMutex;
+    std::condition_variable stopCondition;
+    bool stopping = false;
+}
+
+    Buffer& getBuffer() {
+        if (threadBuffer == nullptr) {
+            std::lock_guard<std::mutex> lock(buffersMutex);
+            buffers.emplace_back(new Buffer());
+            threadBuffer = buffers.back().get();
+            threadBuffer->threadId = static_cast<uint32_t>(buffers.size());
+            threadBuffer->nameWritten = false;
+        }
+        return *threadBuffer;
+    }
+
+    void add(const Event& event) {
+        Buffer& buffer = getBuffer();
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        buffer.events.push_back(event);
+    }
+
+    // Uses the JSON array format, which trace viewers also read without the closing bracket after a crash.
+    void write(std::string& json, uint32_t threadId, const Event& event) {
+        json += written++ == 0 ? "[\n" : ",\n";
+        switch (event.phase) {
+        case 'X':
+            json += fmt::format("{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{},\"dur\":{},\"args\":{{\"id\":{}}}}}",
+                event.name, threadId, event.time, event.duration, event.id);
+            break;
+        default:
+            json += fmt::format("{{\"name\":\"{}\",\"cat\":\"request\",\"ph\":\"{}\",\"pid\":1,\"tid\":{},\"ts\":{},\"id\":{}}}",
+                event.name, event.phase, threadId, event.time, event.id);
+        }
+    }
+
+    void flush() {
+        std::string json;
+        std::vector<Event> events;
+        std::unique_lock<std::mutex> lock(buffersMutex);
+        for (auto& buffer : buffers) {
+            {
+                std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+                events.swap(buffer->events);
+                if (!buffer->nameWritten && !buffer->name.empty()) {
+                    json += written++ == 0 ? "[\n" : ",\n";
+                    json += fmt::format("{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}", buffer->threadId, buffer->name);
+                    buffer->nameWritten = true;
+                }
+            }
+            for (auto& event : events) {
+                write(json, buffer->threadId, event);
+            }
+            events.clear();
+        }
+        lock.unlock();
+        if (json.empty()) { return; }
+        if (!file.is_open()) {
+            file.open(path, std::ios::binary | std::ios::trunc);
+            if (!file) {
+                log::logger->error("Failed to open trace file '{}'!", path);
+                return;
+            }
+        }
+        file.write(json.data(), json.size());
+        file.flush();
+    }
+
+    void runFlush() {
+        std::unique_lock<std::mutex> lock(stopMutex);
+        while (!stopping) {
+            stopCondition.wait_for(lock, flushInterval);
+            lock.unlock();
+            flush();
+            lock.lock();
+        }
+    }
+
+    bool initialize(const std::string& extensionFolder, uint32_t sampleRate_, const std::chrono::milliseconds& flushInterval_) {
+        sampleRate = sampleRate_;
+        flushInterval = flushInterval_;
+        if (sampleRate == 0) { return false; }
+        std::string folder = fmt::format("{}{}{}", extensionFolder, Poco::Path::separator(), TRACE_FOLDER);
+        try {
+            Poco::File(folder).createDirectories();
+        }
+        catch (Poco::Exception& e) {
+            log::logger->error("Failed to create trace folder '{}'! Error message: {}", folder, e.displayText());
+            return false;
+        }
+        std::string fileName = "trace";
+        Poco::DateTimeFormatter::append(fileName, Poco::LocalDateTime(), "_%Y-%m-%d_%H-%M-%S");
+        path = fmt::format("{}{}{}{}", folder, Poco::Path::separator(), fileName, TRACE_EXTENSION);
+        start = std::chrono::steady_clock::now();
+        stopping = false;
+        enabled = true;
+        flushThread = std::thread(runFlush);
+        log::logger->info("Tracing one in '{}' calls to '{}'.", sampleRate, path);
+        return true;
+    }
+
+    void finalize() {
+        if (!enabled) { return; }
+        {
+            std::lock_guard<std::mutex> lock(stopMutex);
+            stopping = true;
+        }
+        stopCondition.notify_one();
+        flushThread.join();
+        flush();
+        enabled = false;
+        if (file.is_open()) {
+            file << "\n]\n";
+            file.close();
+        }
+        log::logger->info("Wrote '{}' trace events to '{}'.", written, path);
+    }
+
+    bool isEnabled() {
+        return enabled;
+    }
+
+    uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    uint32_t sample() {
+        if (!enabled || sampled++ % sampleRate != 0) { return 0; }
+        return nextId++;
+    }
+
+    void complete(const char* name, uint32_t id, uint64_t start, uint64_t end) {
+        add(Event{ name, 'X', id, start, end - start });
+    }
+
+    void begin(const char* name, uint32_t id, uint64_t time) {
+        add(Event{ name, 'b', id, time, 0 });
+    }
+
+    void end(const char* name, uint32_t id, uint64_t time) {
+        add(Event{ name, 'e', id, time, 0 });
+    }
+
+    void setThreadName(const std::string& name) {
+        if (!enabled) { return; }
+        Buffer& buffer = getBuffer();
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        buffer.name = name;
+    }
+
+} // namespace trace
+} // namespace r3
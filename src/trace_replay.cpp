@@ -0,0 +1,90 @@
+#include "capture.h"
+#include "extension.h"
+#include "util.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Plays a trace recorded with r3.capture.enabled back through the extension, using the
+// config.properties of the extension folder, so mission load can be reproduced offline.
+// Speed 1 keeps the recorded timing, 2 plays twice as fast and 0 calls as fast as possible.
+
+namespace {
+    const int OUTPUT_SIZE = 10240;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: r3_trace_replay <trace file> [speed]" << std::endl
+            << "  speed 1 replays at the recorded pace (default), 2 twice as fast, 0 flat out" << std::endl;
+        return 1;
+    }
+    double speed = argc > 2 ? std::atof(argv[2]) : 1.0;
+
+    if (!r3::extension::initialize()) {
+        std::cerr << "Failed to initialize the extension, see the extension log." << std::endl;
+        return 1;
+    }
+    // Never record the replay itself into a new trace.
+    r3::capture::finalize();
+
+    std::vector<r3::capture::Entry> entries;
+    if (!r3::capture::load(argv[1], entries)) {
+        std::cerr << "Failed to load trace '" << argv[1] << "'." << std::endl;
+        r3::extension::finalize();
+        return 1;
+    }
+    std::cout << "Replaying " << entries.size() << " calls from '" << argv[1] << "' at speed " << speed << "." << std::endl;
+
+    std::vector<char> output(OUTPUT_SIZE);
+    std::vector<uint64_t> latencies;
+    latencies.reserve(entries.size());
+    size_t errors = 0;
+    uint64_t maxLag = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto& entry : entries) {
+        if (speed > 0) {
+            auto due = start + std::chrono::microseconds(static_cast<uint64_t>(entry.time / speed));
+            auto now = std::chrono::steady_clock::now();
+            if (now < due) {
+                std::this_thread::sleep_until(due);
+            }
+            else {
+                maxLag = std::max<uint64_t>(maxLag, std::chrono::duration_cast<std::chrono::microseconds>(now - due).count());
+            }
+        }
+        auto callStart = std::chrono::steady_clock::now();
+        // Same as RVExtension, which reserves the last byte for the terminator.
+        r3::extension::call(output.data(), OUTPUT_SIZE - 1, entry.function.c_str());
+        latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - callStart).count());
+        if (std::strncmp(output.data(), "[\"error\"", 8) == 0) {
+            errors++;
+        }
+    }
+    double seconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 1e6;
+
+    // Finalize waits for the writers to empty their queues, unless r3.journal.shutdown journals them instead.
+    auto finalizeStart = std::chrono::steady_clock::now();
+    r3::extension::finalize();
+    double finalizeSeconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - finalizeStart).count() / 1e6;
+
+    std::sort(latencies.begin(), latencies.end());
+    std::cout
+        << "Calls:        " << latencies.size() << " (" << errors << " errors)" << std::endl
+        << "Duration:     " << seconds << " s, finalize " << finalizeSeconds << " s" << std::endl
+        << "Throughput:   " << (seconds > 0 ? latencies.size() / seconds : 0) << " calls/s, "
+            << (seconds + finalizeSeconds > 0 ? latencies.size() / (seconds + finalizeSeconds) : 0) << " calls/s including finalize" << std::endl
+        << "Call latency: p50 " << r3::util::getPercentile(latencies, 0.50) << " us, p90 " << r3::util::getPercentile(latencies, 0.90)
+            << " us, p99 " << r3::util::getPercentile(latencies, 0.99) << " us, p99.9 " << r3::util::getPercentile(latencies, 0.999)
+            << " us, max " << r3::util::getPercentile(latencies, 1.0) << " us" << std::endl;
+    if (speed > 0) {
+        std::cout << "Max lag:      " << maxLag << " us behind the recorded schedule" << std::endl;
+    }
+    return 0;
+}
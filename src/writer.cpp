@@ -0,0 +1,32 @@
+#include "extension.h"
+
+#include <atomic>
+#include <csignal>
+#include <iostream>
+
+// Runs the database side of the extension in its own process. With r3.writer.enabled the extension
+// hands its requests over through a ring in the extension folder while this process' heartbeat
+// is there, so the MySQL client and all batching and retries stay out of the game server process.
+// Start it before the mission connects, stop it with Ctrl+C once the game server is down.
+
+namespace {
+    std::atomic<bool> stopping(false);
+
+    void stop(int) {
+        stopping = true;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (!r3::extension::initialize(r3::remote::Side::Writer) || !r3::remote::isEnabled()) {
+        std::cerr << "Failed to initialize the writer, see the extension log." << std::endl;
+        r3::extension::finalize();
+        return 1;
+    }
+    std::signal(SIGINT, stop);
+    std::signal(SIGTERM, stop);
+    std::cout << "Writing requests from the extension, press Ctrl+C to stop." << std::endl;
+    r3::extension::runWriter(stopping);
+    r3::extension::finalize();
+    return 0;
+}